@@ -3,7 +3,42 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef USERPROG
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#endif
+
+/* Most sectors that the request thread merges into a single
+   transfer. */
+#define MERGE_SECTORS 64
+
+/* Most requests that a transfer to or from user memory has queued
+   at once, one per physically contiguous piece of the buffer. */
+#define USER_REQUESTS (MERGE_SECTORS * BLOCK_SECTOR_SIZE / PGSIZE)
+
+/* Number of buckets in each histogram.  Bucket 0 counts zeros,
+   bucket I counts values from 2**(I-1) up to 2**I - 1, and the
+   last bucket counts everything larger. */
+#define HISTOGRAM_BUCKETS 8
+
+/* Statistics for a device's request queue.  Only the device's
+   request thread and its driver update them, except for
+   DEPTH, which is updated under the queue lock.  Readers may see
+   them slightly out of date. */
+struct block_stats {
+  unsigned long long latency[HISTOGRAM_BUCKETS]; /* Requests by ticks queued and served. */
+  unsigned long long depth[HISTOGRAM_BUCKETS];   /* Requests by queue length on arrival. */
+  unsigned long long sequential_cnt;             /* Transfers starting at the head. */
+  unsigned long long random_cnt;                 /* Transfers that moved the head. */
+  int64_t start;                                 /* Tick when the device was registered. */
+  int64_t busy_ticks;                            /* Ticks spent in the driver. */
+  int64_t wait_ticks;                            /* Ticks the driver waited for its bus. */
+};
 
 /* A block device. */
 struct block {
@@ -18,6 +53,18 @@ struct block {
 
   unsigned long long read_cnt;  /* Number of sectors read. */
   unsigned long long write_cnt; /* Number of sectors written. */
+
+  /* Request queue, served by the device's request thread.  Not
+     used by devices that remap their requests. */
+  struct lock queue_lock;                  /* Protects the members below. */
+  struct condition queue_ready;            /* Signaled when a request is queued. */
+  struct list queue;                       /* Queued requests. */
+  const struct block_scheduler* scheduler; /* Orders QUEUE. */
+  block_sector_t head;                     /* Sector just past the last one served. */
+  uint8_t* merge_buffer;                   /* MERGE_SECTORS sectors, or null. */
+
+  const void* bus;          /* Identifies the bus the device is on. */
+  struct block_stats stats; /* Request queue statistics. */
 };
 
 /* List of all block devices. */
@@ -27,6 +74,7 @@ static struct list all_blocks = LIST_INITIALIZER(all_blocks);
 static struct block* block_by_role[BLOCK_ROLE_CNT];
 
 static struct block* list_elem_to_block(struct list_elem*);
+static thread_func request_thread NO_RETURN;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -90,14 +138,182 @@ static void check_sector(struct block* block, block_sector_t sector) {
   }
 }
 
+/* Verifies that the CNT sectors starting at SECTOR all lie
+   within BLOCK.  Panics if not. */
+static void check_sectors(struct block* block, block_sector_t sector, size_t cnt) {
+  check_sector(block, sector);
+  if (cnt > block->size - sector)
+    PANIC("Access past end of device %s (sector=%" PRDSNu ", count=%zu, "
+          "size=%" PRDSNu ")\n",
+          block_name(block), sector, cnt, block->size);
+}
+
+/* Returns the histogram bucket that VALUE falls into. */
+static int bucket(uint64_t value) {
+  int i;
+
+  for (i = 0; value > 0 && i < HISTOGRAM_BUCKETS - 1; i++)
+    value >>= 1;
+  return i;
+}
+
+/* Queues REQUEST on BLOCK and returns, usually before the
+   request is served.  REQUEST->COMPLETE is called from BLOCK's
+   request thread once it has been.  REQUEST->SECTOR may be
+   changed meanwhile.  REQUEST->BUFFER must be in kernel memory,
+   because the request thread runs without any process's page
+   directory. */
+void block_submit(struct block* block, struct block_request* request) {
+  struct block* target;
+
+  ASSERT(request->cnt > 0);
+  ASSERT(is_kernel_vaddr(request->buffer));
+  check_sectors(block, request->sector, request->cnt);
+  ASSERT(!request->write || block->type != BLOCK_FOREIGN);
+
+  lock_acquire(&block->queue_lock);
+  if (request->write)
+    block->write_cnt += request->cnt;
+  else
+    block->read_cnt += request->cnt;
+  if (block->ops->remap == NULL) {
+    request->start = timer_ticks();
+    block->stats.depth[bucket(list_size(&block->queue))]++;
+    block->scheduler->add(&block->queue, request);
+    cond_signal(&block->queue_ready, &block->queue_lock);
+  }
+  lock_release(&block->queue_lock);
+
+  if (block->ops->remap != NULL) {
+    target = block->ops->remap(block->aux, &request->sector);
+    block_submit(target, request);
+  }
+}
+
+/* Completion function for the requests made by transfer(). */
+static void wake_waiter(struct block_request* request) { sema_up(request->aux); }
+
+/* Submits a request to read or write, according to WRITE, CNT
+   sectors starting at SECTOR between BLOCK and BUFFER, which must
+   be in kernel memory, and waits until it is done. */
+static void wait_for(struct block* block, block_sector_t sector, size_t cnt, void* buffer,
+                     bool write) {
+  struct block_request request;
+  struct semaphore done;
+
+  sema_init(&done, 0);
+  request.sector = sector;
+  request.cnt = cnt;
+  request.buffer = buffer;
+  request.write = write;
+  request.complete = wake_waiter;
+  request.aux = &done;
+  block_submit(block, &request);
+  sema_down(&done);
+}
+
+#ifdef USERPROG
+/* Returns the kernel address of the sector of data at user
+   address UADDR in the current process, or a null pointer if
+   the sector spans two pages that are not next to each other in
+   physical memory.  The pages must be present, as they are for a
+   buffer that the system call layer has checked and pinned. */
+static uint8_t* user_sector(const uint8_t* uaddr) {
+  uint32_t* pd = thread_current()->pcb->pagedir;
+  uint8_t* first = pagedir_get_page(pd, uaddr);
+  uint8_t* last = pagedir_get_page(pd, uaddr + BLOCK_SECTOR_SIZE - 1);
+
+  ASSERT(first != NULL && last != NULL);
+  return last == first + BLOCK_SECTOR_SIZE - 1 ? first : NULL;
+}
+
+/* Reads or writes, according to WRITE, CNT sectors starting at
+   SECTOR between BLOCK and BUFFER, in the current process's user
+   memory, and waits until done.  The request thread cannot see
+   user memory, so each physically contiguous piece of BUFFER is
+   translated to its kernel address here and queued as a request
+   of its own, several at once so that the request thread can
+   serve them as one transfer.  Only a sector split across pages
+   that are not contiguous goes through a bounce buffer.  Since
+   the device, not the CPU, writes the data that it reads, the
+   pages are marked dirty afterward. */
+static void transfer_user(struct block* block, block_sector_t sector, size_t cnt,
+                          uint8_t* buffer, bool write) {
+  uint32_t* pd = thread_current()->pcb->pagedir;
+  struct block_request requests[USER_REQUESTS];
+  uint8_t bounce[BLOCK_SECTOR_SIZE];
+  struct semaphore done;
+
+  sema_init(&done, 0);
+  while (cnt > 0) {
+    uint8_t* start = buffer;
+    size_t req_cnt = 0;
+    uint8_t* kaddr;
+    uint8_t* page;
+    size_t i;
+
+    while (cnt > 0 && (kaddr = user_sector(buffer)) != NULL) {
+      struct block_request* r = req_cnt > 0 ? &requests[req_cnt - 1] : NULL;
+      if (r == NULL || (uint8_t*)r->buffer + r->cnt * BLOCK_SECTOR_SIZE != kaddr) {
+        if (req_cnt == USER_REQUESTS)
+          break;
+        r = &requests[req_cnt++];
+        r->sector = sector;
+        r->cnt = 0;
+        r->buffer = kaddr;
+        r->write = write;
+        r->complete = wake_waiter;
+        r->aux = &done;
+      }
+      r->cnt++;
+      buffer += BLOCK_SECTOR_SIZE;
+      sector++;
+      cnt--;
+    }
+    for (i = 0; i < req_cnt; i++)
+      block_submit(block, &requests[i]);
+    for (i = 0; i < req_cnt; i++)
+      sema_down(&done);
+
+    if (req_cnt == 0) {
+      if (write)
+        memcpy(bounce, buffer, BLOCK_SECTOR_SIZE);
+      wait_for(block, sector, 1, bounce, write);
+      if (!write)
+        memcpy(buffer, bounce, BLOCK_SECTOR_SIZE);
+      buffer += BLOCK_SECTOR_SIZE;
+      sector++;
+      cnt--;
+    } else if (!write)
+      for (page = pg_round_down(start); page < buffer; page += PGSIZE)
+        pagedir_set_dirty(pd, page, true);
+  }
+}
+#endif
+
+/* Reads or writes, according to WRITE, CNT sectors starting at
+   SECTOR between BLOCK and BUFFER, and waits until done. */
+static void transfer(struct block* block, block_sector_t sector, size_t cnt, void* buffer,
+                     bool write) {
+  if (cnt == 0)
+    return;
+  if (is_kernel_vaddr(buffer))
+    wait_for(block, sector, cnt, buffer, write);
+  else {
+#ifdef USERPROG
+    transfer_user(block, sector, cnt, buffer, write);
+#else
+    PANIC("block transfer to user address %p", buffer);
+#endif
+  }
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
    per-block device locking is unneeded. */
 void block_read(struct block* block, block_sector_t sector, void* buffer) {
-  check_sector(block, sector);
-  block->ops->read(block->aux, sector, buffer);
-  block->read_cnt++;
+  transfer(block, sector, 1, buffer, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -106,10 +322,199 @@ void block_read(struct block* block, block_sector_t sector, void* buffer) {
    Internally synchronizes accesses to block devices, so external
    per-block device locking is unneeded. */
 void block_write(struct block* block, block_sector_t sector, const void* buffer) {
-  check_sector(block, sector);
-  ASSERT(block->type != BLOCK_FOREIGN);
-  block->ops->write(block->aux, sector, buffer);
-  block->write_cnt++;
+  transfer(block, sector, 1, (void*)buffer, true);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that support it transfer the whole run with a
+   single request.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void block_read_multiple(struct block* block, block_sector_t sector, size_t cnt, void* buffer) {
+  transfer(block, sector, cnt, buffer, false);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving the
+   data.  Drivers that support it transfer the whole run with a
+   single request.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void block_write_multiple(struct block* block, block_sector_t sector, size_t cnt,
+                          const void* buffer) {
+  transfer(block, sector, cnt, (void*)buffer, true);
+}
+
+/* Has BLOCK's driver read or write, according to WRITE, CNT
+   sectors starting at SECTOR between the device and BUFFER. */
+static void driver_transfer(struct block* block, block_sector_t sector, size_t cnt,
+                            uint8_t* buffer, bool write) {
+  const struct block_operations* ops = block->ops;
+  size_t i;
+
+  if (write && ops->write_multiple != NULL)
+    ops->write_multiple(block->aux, sector, cnt, buffer);
+  else if (!write && ops->read_multiple != NULL)
+    ops->read_multiple(block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++) {
+      if (write)
+        ops->write(block->aux, sector + i, buffer + i * BLOCK_SECTOR_SIZE);
+      else
+        ops->read(block->aux, sector + i, buffer + i * BLOCK_SECTOR_SIZE);
+    }
+}
+
+/* Returns the request in QUEUE, if any, that reads or writes,
+   according to WRITE, at most ROOM sectors starting at SECTOR. */
+static struct block_request* find_adjacent(struct list* queue, bool write, block_sector_t sector,
+                                           size_t room) {
+  struct list_elem* e;
+
+  for (e = list_begin(queue); e != list_end(queue); e = list_next(e)) {
+    struct block_request* r = list_entry(e, struct block_request, elem);
+    if (r->write == write && r->sector == sector && r->cnt <= room)
+      return r;
+  }
+  return NULL;
+}
+
+/* Serves BATCH, a list of requests on BLOCK that together cover
+   CNT sectors starting at SECTOR, in order, with a single
+   transfer, and then completes them.  Several requests go through
+   BLOCK's merge buffer. */
+static void serve(struct block* block, struct list* batch, block_sector_t sector, size_t cnt,
+                  bool write) {
+  int64_t start = timer_ticks();
+  struct list_elem* e;
+
+  if (list_size(batch) == 1) {
+    struct block_request* r = list_entry(list_front(batch), struct block_request, elem);
+    driver_transfer(block, sector, cnt, r->buffer, write);
+  } else {
+    uint8_t* p;
+
+    if (write)
+      for (p = block->merge_buffer, e = list_begin(batch); e != list_end(batch);
+           e = list_next(e)) {
+        struct block_request* r = list_entry(e, struct block_request, elem);
+        memcpy(p, r->buffer, r->cnt * BLOCK_SECTOR_SIZE);
+        p += r->cnt * BLOCK_SECTOR_SIZE;
+      }
+    driver_transfer(block, sector, cnt, block->merge_buffer, write);
+    if (!write)
+      for (p = block->merge_buffer, e = list_begin(batch); e != list_end(batch);
+           e = list_next(e)) {
+        struct block_request* r = list_entry(e, struct block_request, elem);
+        memcpy(r->buffer, p, r->cnt * BLOCK_SECTOR_SIZE);
+        p += r->cnt * BLOCK_SECTOR_SIZE;
+      }
+  }
+  block->stats.busy_ticks += timer_elapsed(start);
+
+  /* A request may be freed as soon as it completes, so take it
+     off BATCH first. */
+  while (!list_empty(batch)) {
+    struct block_request* r = list_entry(list_pop_front(batch), struct block_request, elem);
+    block->stats.latency[bucket(timer_elapsed(r->start))]++;
+    r->complete(r);
+  }
+}
+
+/* Request thread for the block device passed as AUX.  Takes the
+   request that the scheduler picks, along with queued requests
+   for the sectors that follow it, and serves them together. */
+static void request_thread(void* block_) {
+  struct block* block = block_;
+
+  for (;;) {
+    struct block_request* first;
+    struct list batch;
+    size_t cnt;
+
+    list_init(&batch);
+    lock_acquire(&block->queue_lock);
+    while (list_empty(&block->queue))
+      cond_wait(&block->queue_ready, &block->queue_lock);
+    first = block->scheduler->next(&block->queue, block->head);
+    list_remove(&first->elem);
+    list_push_back(&batch, &first->elem);
+    cnt = first->cnt;
+    if (block->merge_buffer != NULL)
+      while (cnt < MERGE_SECTORS) {
+        struct block_request* r =
+            find_adjacent(&block->queue, first->write, first->sector + cnt, MERGE_SECTORS - cnt);
+        if (r == NULL)
+          break;
+        list_remove(&r->elem);
+        list_push_back(&batch, &r->elem);
+        cnt += r->cnt;
+      }
+    if (first->sector == block->head)
+      block->stats.sequential_cnt++;
+    else
+      block->stats.random_cnt++;
+    block->head = first->sector + cnt;
+    lock_release(&block->queue_lock);
+
+    serve(block, &batch, first->sector, cnt, first->write);
+  }
+}
+
+/* First-come, first-served scheduler. */
+
+static void fifo_add(struct list* queue, struct block_request* request) {
+  list_push_back(queue, &request->elem);
+}
+
+static struct block_request* fifo_next(struct list* queue, block_sector_t head UNUSED) {
+  return list_entry(list_front(queue), struct block_request, elem);
+}
+
+const struct block_scheduler block_fifo_scheduler = {"fifo", fifo_add, fifo_next};
+
+/* C-LOOK scheduler.  Keeps the queue sorted by sector and sweeps
+   upward from the head, jumping back to the lowest queued sector
+   at the top.  No request waits for more than one sweep. */
+
+static bool request_less(const struct list_elem* a_, const struct list_elem* b_,
+                         void* aux UNUSED) {
+  const struct block_request* a = list_entry(a_, struct block_request, elem);
+  const struct block_request* b = list_entry(b_, struct block_request, elem);
+  return a->sector < b->sector;
+}
+
+static void clook_add(struct list* queue, struct block_request* request) {
+  list_insert_ordered(queue, &request->elem, request_less, NULL);
+}
+
+static struct block_request* clook_next(struct list* queue, block_sector_t head) {
+  struct list_elem* e;
+
+  for (e = list_begin(queue); e != list_end(queue); e = list_next(e)) {
+    struct block_request* r = list_entry(e, struct block_request, elem);
+    if (r->sector >= head)
+      return r;
+  }
+  return list_entry(list_front(queue), struct block_request, elem);
+}
+
+const struct block_scheduler block_clook_scheduler = {"c-look", clook_add, clook_next};
+
+/* Makes SCHEDULER order BLOCK's requests from now on. */
+void block_set_scheduler(struct block* block, const struct block_scheduler* scheduler) {
+  struct list old;
+
+  list_init(&old);
+  lock_acquire(&block->queue_lock);
+  while (!list_empty(&block->queue))
+    list_push_back(&old, list_pop_front(&block->queue));
+  block->scheduler = scheduler;
+  while (!list_empty(&old))
+    scheduler->add(&block->queue, list_entry(list_pop_front(&old), struct block_request, elem));
+  lock_release(&block->queue_lock);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -121,6 +526,72 @@ const char* block_name(struct block* block) { return block->name; }
 /* Returns BLOCK's type. */
 enum block_type block_type(struct block* block) { return block->type; }
 
+/* Records that BLOCK is on BUS, along with any other devices
+   for which the driver passes the same BUS. */
+void block_set_bus(struct block* block, const void* bus) { block->bus = bus; }
+
+/* Returns the bus that BLOCK is on. */
+const void* block_bus(struct block* block) { return block->bus; }
+
+/* Records that BLOCK's driver waited TICKS timer ticks for
+   another device on the same bus to finish.  Called by drivers
+   from within their operations. */
+void block_record_wait(struct block* block, int64_t ticks) { block->stats.wait_ticks += ticks; }
+
+/* Prints HISTOGRAM, labeled with NAME, on one line. */
+static void print_histogram(const char* name, const unsigned long long histogram[]) {
+  int i;
+
+  printf("  %-13s", name);
+  for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    unsigned long long lo = i == 0 ? 0 : 1ull << (i - 1);
+    unsigned long long hi = (1ull << i) - 1;
+
+    if (i == HISTOGRAM_BUCKETS - 1)
+      printf(" %llu+:", lo);
+    else if (lo >= hi)
+      printf(" %llu:", lo);
+    else
+      printf(" %llu-%llu:", lo, hi);
+    printf("%llu", histogram[i]);
+  }
+  printf("\n");
+}
+
+/* Prints detailed statistics for every block device: the data
+   moved and its rate, over the device's lifetime and over the
+   time the device was busy, how many transfers continued where
+   the previous one ended, time spent waiting for the bus, and
+   histograms of request latency and of the queue depth that
+   requests found on arrival.  Times are in timer ticks.  A device
+   that remaps its requests, such as a partition, only has
+   counts, because its requests are queued on the device below. */
+void block_print_io_stats(void) {
+  struct list_elem* e;
+
+  for (e = list_begin(&all_blocks); e != list_end(&all_blocks); e = list_next(e)) {
+    struct block* block = list_entry(e, struct block, list_elem);
+    const struct block_stats* st = &block->stats;
+    uint64_t bytes = (block->read_cnt + block->write_cnt) * BLOCK_SECTOR_SIZE;
+    int64_t elapsed = timer_elapsed(st->start);
+    unsigned long long transfers = st->sequential_cnt + st->random_cnt;
+
+    printf("%s (%s): %llu reads, %llu writes\n", block->name, block_type_name(block->type),
+           block->read_cnt, block->write_cnt);
+    if (block->ops->remap != NULL)
+      continue;
+
+    printf("  %llu bytes/s overall, %llu bytes/s busy, busy %lld of %lld ticks\n",
+           elapsed > 0 ? bytes * TIMER_FREQ / elapsed : 0,
+           st->busy_ticks > 0 ? bytes * TIMER_FREQ / st->busy_ticks : 0, st->busy_ticks,
+           elapsed);
+    printf("  %llu transfers, %llu sequential, %llu random, %lld ticks waiting for bus\n",
+           transfers, st->sequential_cnt, st->random_cnt, st->wait_ticks);
+    print_histogram("latency:", st->latency);
+    print_histogram("queue depth:", st->depth);
+  }
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void block_print_stats(void) {
   int i;
@@ -153,6 +624,25 @@ struct block* block_register(const char* name, enum block_type type, const char*
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  lock_init(&block->queue_lock);
+  cond_init(&block->queue_ready);
+  list_init(&block->queue);
+  block->scheduler = &block_clook_scheduler;
+  block->head = 0;
+  block->merge_buffer = NULL;
+  block->bus = block;
+  memset(&block->stats, 0, sizeof block->stats);
+  block->stats.start = timer_ticks();
+
+  /* Devices that remap their requests have no queue of their own.
+     The request thread runs at the highest priority so that
+     waiting for I/O never waits for the CPU as well.  Without a
+     merge buffer, requests are just not merged. */
+  if (ops->remap == NULL) {
+    block->merge_buffer = malloc(MERGE_SECTORS * BLOCK_SECTOR_SIZE);
+    if (thread_create(block->name, PRI_MAX, request_thread, block) == TID_ERROR)
+      PANIC("Failed to create request thread for block device %s", block->name);
+  }
 
   printf("%s: %'" PRDSNu " sectors (", block->name, block->size);
   print_human_readable_size((uint64_t)block->size * BLOCK_SECTOR_SIZE);
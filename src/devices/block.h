@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -52,20 +53,79 @@ struct block* block_next(struct block*);
 block_sector_t block_size(struct block*);
 void block_read(struct block*, block_sector_t, void*);
 void block_write(struct block*, block_sector_t, const void*);
+void block_read_multiple(struct block*, block_sector_t, size_t cnt, void*);
+void block_write_multiple(struct block*, block_sector_t, size_t cnt, const void*);
 const char* block_name(struct block*);
 enum block_type block_type(struct block*);
 
+/* Devices on the same bus cannot transfer data at the same
+   time.  Each device starts out on a bus of its own. */
+void block_set_bus(struct block*, const void* bus);
+const void* block_bus(struct block*);
+
+/* Asynchronous requests.
+
+   The submitter fills in every member but ELEM and START and
+   leaves the request and its buffer alone until COMPLETE is
+   called.
+   COMPLETE runs in the device's request thread, so it should
+   only record the result and wake up whoever is waiting. */
+struct block_request {
+  struct list_elem elem; /* Element in the device's queue. */
+  block_sector_t sector; /* First sector. */
+  size_t cnt;            /* Number of sectors. */
+  void* buffer;          /* CNT * BLOCK_SECTOR_SIZE bytes of data. */
+  bool write;            /* True to write, false to read. */
+  void (*complete)(struct block_request*); /* Called when done. */
+  void* aux;                               /* For COMPLETE's use. */
+  int64_t start;                           /* Tick when queued. */
+};
+
+void block_submit(struct block*, struct block_request*);
+
+/* An I/O scheduler, which decides the order in which a device
+   serves its queued requests. */
+struct block_scheduler {
+  const char* name;
+
+  /* Adds REQUEST to QUEUE. */
+  void (*add)(struct list* queue, struct block_request* request);
+
+  /* Returns the request in QUEUE, which is not empty, to serve
+     next, without removing it.  HEAD is the sector just past
+     the last one served. */
+  struct block_request* (*next)(struct list* queue, block_sector_t head);
+};
+
+extern const struct block_scheduler block_fifo_scheduler;
+extern const struct block_scheduler block_clook_scheduler;
+void block_set_scheduler(struct block*, const struct block_scheduler*);
+
 /* Statistics. */
 void block_print_stats(void);
+void block_print_io_stats(void);
 
 /* Lower-level interface to block device drivers. */
 
 struct block_operations {
   void (*read)(void* aux, block_sector_t, void* buffer);
   void (*write)(void* aux, block_sector_t, const void* buffer);
+
+  /* Optional.  Transfer CNT consecutive sectors at once.  If null,
+     the block layer calls READ or WRITE once per sector instead. */
+  void (*read_multiple)(void* aux, block_sector_t, size_t cnt, void* buffer);
+  void (*write_multiple)(void* aux, block_sector_t, size_t cnt, const void* buffer);
+
+  /* Optional.  For a device that is a window onto part of another
+     device, such as a partition, translates *SECTOR into a sector
+     of the other device and returns that device.  Requests then
+     go straight to the other device's queue, and READ, WRITE and
+     the rest are not used. */
+  struct block* (*remap)(void* aux, block_sector_t* sector);
 };
 
 struct block* block_register(const char* name, enum block_type, const char* extra_info,
                              block_sector_t size, const struct block_operations*, void* aux);
+void block_record_wait(struct block*, int64_t ticks);
 
 #endif /* devices/block.h */
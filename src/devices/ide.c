@@ -9,9 +9,17 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   Sectors move between the disk and memory either by PIO, with
+   the CPU copying each word through the data register, or by
+   bus-master DMA, with the controller copying them by itself
+   while the CPU runs other threads.  DMA is used when the PCI IDE
+   controller and the disk both support it, as in QEMU's PIIX
+   emulation, and the buffer is in kernel memory. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)   /* Data. */
@@ -30,10 +38,26 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206) /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl(CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus-master IDE port addresses, relative to each channel's
+   bus-master base. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table address. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80  /* Busy. */
 #define STA_DRDY 0x40 /* Device Ready. */
+#define STA_DF 0x20   /* Device Fault. */
 #define STA_DRQ 0x08  /* Data Request. */
+#define STA_ERR 0x01  /* Error. */
+
+/* Bus-master Command Register bits. */
+#define BM_CMD_START 0x01 /* Start transfer. */
+#define BM_CMD_READ 0x08  /* Transfer from disk to memory. */
+
+/* Bus-master Status Register bits.  Writing 1 clears them. */
+#define BM_STA_ERROR 0x02 /* Transfer failed. */
+#define BM_STA_INTR 0x04  /* Disk raised its interrupt. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04 /* Software Reset. */
@@ -47,8 +71,14 @@
    Many more are defined but this is the small subset that we
    use. */
 #define CMD_IDENTIFY_DEVICE 0xec    /* IDENTIFY DEVICE. */
-#define CMD_READ_SECTOR_RETRY 0x20  /* READ SECTOR with retries. */
-#define CMD_WRITE_SECTOR_RETRY 0x30 /* WRITE SECTOR with retries. */
+#define CMD_READ_SECTOR_RETRY 0x20  /* READ SECTOR(S) with retries. */
+#define CMD_WRITE_SECTOR_RETRY 0x30 /* WRITE SECTOR(S) with retries. */
+#define CMD_READ_DMA 0xc8           /* READ DMA. */
+#define CMD_WRITE_DMA 0xca          /* WRITE DMA. */
+
+/* Most sectors that a single READ SECTOR(S) or WRITE SECTOR(S)
+   command can transfer.  A sector count of 0 means this many. */
+#define MAX_COMMAND_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk {
@@ -56,8 +86,25 @@ struct ata_disk {
   struct channel* channel; /* Channel that disk is attached to. */
   int dev_no;              /* Device 0 or 1 for master or slave. */
   bool is_ata;             /* Is device an ATA disk? */
+  bool dma;                /* Use bus-master DMA? */
+  struct block* block;     /* Block device, once registered. */
 };
 
+/* A physical region descriptor, which tells the bus-master
+   controller where in memory to transfer part of a request.  A
+   region may not cross a 64 kB boundary. */
+struct prd {
+  uint32_t addr;  /* Physical address. */
+  uint16_t size;  /* Size in bytes, 0 meaning 64 kB. */
+  uint16_t flags; /* PRD_EOT for the last region. */
+};
+
+#define PRD_EOT 0x8000 /* End of table. */
+
+/* A request of MAX_COMMAND_SECTORS sectors is 128 kB long, so it
+   crosses at most two 64 kB boundaries. */
+#define PRD_CNT 3
+
 /* An ATA channel (aka controller).
    Each channel can control up to two disks. */
 struct channel {
@@ -70,6 +117,9 @@ struct channel {
                                    any interrupt would be spurious. */
   struct semaphore completion_wait; /* Up'd by interrupt handler. */
 
+  uint16_t bm_base; /* Bus-master base port, 0 if no DMA. */
+  struct prd* prd;  /* PRD table for DMA transfers. */
+
   struct ata_disk devices[2]; /* The devices on this channel. */
 };
 
@@ -77,14 +127,24 @@ struct channel {
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* A PRD table.  The controller requires a table not to cross a
+   64 kB boundary, so each table is aligned to 32 bytes, which is
+   at least its size. */
+struct prd_table {
+  struct prd prd[PRD_CNT];
+} __attribute__((aligned(32)));
+
+/* PRD tables, one per channel. */
+static struct prd_table prd_tables[CHANNEL_CNT];
+
 static struct block_operations ide_operations;
 
 static void reset_channel(struct channel*);
 static bool check_device_type(struct ata_disk*);
 static void identify_ata_device(struct ata_disk*);
 
-static void select_sector(struct ata_disk*, block_sector_t);
-static void issue_pio_command(struct channel*, uint8_t command);
+static void select_sector(struct ata_disk*, block_sector_t, size_t cnt);
+static void issue_command(struct channel*, uint8_t command);
 static void input_sector(struct channel*, void*);
 static void output_sector(struct channel*, const void*);
 
@@ -95,8 +155,11 @@ static void select_device_wait(const struct ata_disk*);
 
 static void interrupt_handler(struct intr_frame*);
 
+static uint16_t find_bus_master(void);
+
 /* Initialize the disk subsystem and detect disks. */
 void ide_init(void) {
+  uint16_t bm_base = find_bus_master();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
@@ -120,6 +183,8 @@ void ide_init(void) {
     lock_init(&c->lock);
     c->expecting_interrupt = false;
     sema_init(&c->completion_wait, 0);
+    c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+    c->prd = prd_tables[chan_no].prd;
 
     /* Initialize devices. */
     for (dev_no = 0; dev_no < 2; dev_no++) {
@@ -128,6 +193,8 @@ void ide_init(void) {
       d->channel = c;
       d->dev_no = dev_no;
       d->is_ata = false;
+      d->dma = false;
+      d->block = NULL;
     }
 
     /* Register interrupt handler. */
@@ -147,6 +214,56 @@ void ide_init(void) {
   }
 }
 
+/* PCI configuration space ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Returns the 32-bit PCI configuration register at offset REG of
+   function FUNC of device DEV on bus 0. */
+static uint32_t pci_read_config(int dev, int func, int reg) {
+  outl(PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  return inl(PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit PCI configuration register at
+   offset REG of function FUNC of device DEV on bus 0. */
+static void pci_write_config(int dev, int func, int reg, uint32_t value) {
+  outl(PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  outl(PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0, where PC chipsets put it, for an IDE
+   controller that drives the legacy channels and supports bus
+   mastering.  If there is one, enables bus mastering and returns
+   its bus-master base port.  Otherwise, returns 0. */
+static uint16_t find_bus_master(void) {
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++) {
+      uint32_t id = pci_read_config(dev, func, 0x00);
+      uint32_t class = pci_read_config(dev, func, 0x08);
+      uint32_t bar4;
+
+      if ((id & 0xffff) == 0xffff)
+        continue;
+
+      /* Class 1 (mass storage), subclass 1 (IDE).  The
+         programming interface says whether the channels are at
+         the legacy ports and whether bus mastering works. */
+      if ((class >> 16) != 0x0101 || (class & 0x8500) != 0x8000)
+        continue;
+      bar4 = pci_read_config(dev, func, 0x20);
+      if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+        continue;
+
+      /* Enable I/O space access and bus mastering. */
+      pci_write_config(dev, func, 0x04, pci_read_config(dev, func, 0x04) | 0x05);
+      return bar4 & 0xfffc;
+    }
+  return 0;
+}
+
 /* Disk detection and identification. */
 
 static char* descramble_ata_string(char*, int size);
@@ -249,7 +366,7 @@ static void identify_ata_device(struct ata_disk* d) {
      indicating the device's response is ready, and read the data
      into our buffer. */
   select_device_wait(d);
-  issue_pio_command(c, CMD_IDENTIFY_DEVICE);
+  issue_command(c, CMD_IDENTIFY_DEVICE);
   sema_down(&c->completion_wait);
   if (!wait_while_busy(d)) {
     d->is_ata = false;
@@ -262,7 +379,11 @@ static void identify_ata_device(struct ata_disk* d) {
   capacity = *(uint32_t*)&id[60 * 2];
   model = descramble_ata_string(&id[10 * 2], 20);
   serial = descramble_ata_string(&id[27 * 2], 40);
-  snprintf(extra_info, sizeof extra_info, "model \"%s\", serial \"%s\"", model, serial);
+
+  /* Word 49 bit 8 says whether the disk supports DMA. */
+  d->dma = c->bm_base != 0 && (*(uint16_t*)&id[49 * 2] & 0x0100) != 0;
+  snprintf(extra_info, sizeof extra_info, "model \"%s\", serial \"%s\"%s", model, serial,
+           d->dma ? ", DMA" : "");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -279,6 +400,8 @@ static void identify_ata_device(struct ata_disk* d) {
 
   /* Register. */
   block = block_register(d->name, BLOCK_RAW, extra_info, capacity, &ide_operations, d);
+  block_set_bus(block, c);
+  d->block = block;
   partition_scan(block);
 }
 
@@ -306,53 +429,205 @@ static char* descramble_ata_string(char* string, int size) {
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Returns true if a transfer between disk D and BUFFER can use
+   bus-master DMA.  The controller needs BUFFER's physical
+   address, which is known only for kernel memory, and it cannot
+   transfer to an odd address. */
+static bool use_dma(const struct ata_disk* d, const void* buffer) {
+  return d->dma && is_kernel_vaddr(buffer) && ((uintptr_t)buffer & 1) == 0;
+}
+
+/* Fills in channel C's PRD table to describe the SIZE bytes of
+   kernel memory at BUFFER, which are physically contiguous. */
+static void build_prd_table(struct channel* c, const void* buffer, size_t size) {
+  uintptr_t addr = vtop(buffer);
+  struct prd* p = c->prd;
+
+  while (size > 0) {
+    size_t n = 0x10000 - (addr & 0xffff);
+    if (n > size)
+      n = size;
+
+    ASSERT(p < c->prd + PRD_CNT);
+    p->addr = addr;
+    p->size = n & 0xffff;
+    p->flags = 0;
+    p++;
+
+    addr += n;
+    size -= n;
+  }
+  p[-1].flags = PRD_EOT;
+}
+
+/* Clears the error and interrupt bits in channel C's bus-master
+   status register. */
+static void clear_bm_status(struct channel* c) {
+  outb(reg_bm_status(c), inb(reg_bm_status(c)) | BM_STA_ERROR | BM_STA_INTR);
+}
+
+/* Transfers CNT sectors, at most MAX_COMMAND_SECTORS, starting at
+   SEC_NO between disk D and BUFFER with bus-master DMA, reading
+   from the disk if WRITE is false or writing to it if WRITE is
+   true.  The caller must hold D's channel lock.  The thread
+   sleeps until the single completion interrupt. */
+static void dma_transfer(struct ata_disk* d, block_sector_t sec_no, size_t cnt, void* buffer,
+                         bool write) {
+  struct channel* c = d->channel;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  uint8_t bm_status, status;
+
+  build_prd_table(c, buffer, cnt * BLOCK_SECTOR_SIZE);
+  outl(reg_bm_prdt(c), vtop(c->prd));
+  outb(reg_bm_command(c), direction);
+  clear_bm_status(c);
+
+  select_sector(d, sec_no, cnt);
+  issue_command(c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb(reg_bm_command(c), direction | BM_CMD_START);
+  sema_down(&c->completion_wait);
+
+  outb(reg_bm_command(c), direction);
+  bm_status = inb(reg_bm_status(c));
+  status = inb(reg_alt_status(c));
+  clear_bm_status(c);
+  if ((bm_status & BM_STA_ERROR) || (status & (STA_ERR | STA_DF)))
+    PANIC("%s: disk %s failed, sector=%" PRDSNu, d->name, write ? "write" : "read", sec_no);
+}
+
+/* Reads CNT sectors, at most MAX_COMMAND_SECTORS, starting at
+   SEC_NO from disk D into BUFFER in PIO mode.  The caller must
+   hold D's channel lock.  The disk interrupts as each sector
+   becomes ready to read. */
+static void pio_read(struct ata_disk* d, block_sector_t sec_no, size_t cnt, uint8_t* buffer) {
+  struct channel* c = d->channel;
+  size_t i;
+
+  select_sector(d, sec_no, cnt);
+  issue_command(c, CMD_READ_SECTOR_RETRY);
+  for (i = 0; i < cnt; i++) {
+    sema_down(&c->completion_wait);
+    if (!wait_while_busy(d))
+      PANIC("%s: disk read failed, sector=%" PRDSNu, d->name, sec_no + i);
+    input_sector(c, buffer + i * BLOCK_SECTOR_SIZE);
+  }
+}
+
+/* Writes CNT sectors, at most MAX_COMMAND_SECTORS, starting at
+   SEC_NO to disk D from BUFFER in PIO mode.  The caller must hold
+   D's channel lock.  The disk interrupts as it finishes each
+   sector. */
+static void pio_write(struct ata_disk* d, block_sector_t sec_no, size_t cnt,
+                      const uint8_t* buffer) {
+  struct channel* c = d->channel;
+  size_t i;
+
+  select_sector(d, sec_no, cnt);
+  issue_command(c, CMD_WRITE_SECTOR_RETRY);
+  for (i = 0; i < cnt; i++) {
+    if (!wait_while_busy(d))
+      PANIC("%s: disk write failed, sector=%" PRDSNu, d->name, sec_no + i);
+    output_sector(c, buffer + i * BLOCK_SECTOR_SIZE);
+    sema_down(&c->completion_wait);
+  }
+}
+
+/* Acquires the lock on D's channel, recording any time spent
+   waiting for the other device on the channel. */
+static void acquire_channel(struct ata_disk* d) {
+  int64_t start = timer_ticks();
+
+  lock_acquire(&d->channel->lock);
+  if (d->block != NULL)
+    block_record_wait(d->block, timer_elapsed(start));
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.  Issues
+   one command per MAX_COMMAND_SECTORS sectors.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
-static void ide_read(void* d_, block_sector_t sec_no, void* buffer) {
+static void ide_read_multiple(void* d_, block_sector_t sec_no, size_t cnt, void* buffer_) {
   struct ata_disk* d = d_;
   struct channel* c = d->channel;
-  lock_acquire(&c->lock);
-  select_sector(d, sec_no);
-  issue_pio_command(c, CMD_READ_SECTOR_RETRY);
-  sema_down(&c->completion_wait);
-  if (!wait_while_busy(d))
-    PANIC("%s: disk read failed, sector=%" PRDSNu, d->name, sec_no);
-  input_sector(c, buffer);
+  uint8_t* buffer = buffer_;
+
+  acquire_channel(d);
+  while (cnt > 0) {
+    size_t n = cnt < MAX_COMMAND_SECTORS ? cnt : MAX_COMMAND_SECTORS;
+
+    if (use_dma(d, buffer))
+      dma_transfer(d, sec_no, n, buffer, false);
+    else
+      pio_read(d, sec_no, n, buffer);
+    buffer += n * BLOCK_SECTOR_SIZE;
+    sec_no += n;
+    cnt -= n;
+  }
   lock_release(&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns
+   after the disk has acknowledged receiving the data.  Issues one
+   command per MAX_COMMAND_SECTORS sectors.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
-static void ide_write(void* d_, block_sector_t sec_no, const void* buffer) {
+static void ide_write_multiple(void* d_, block_sector_t sec_no, size_t cnt, const void* buffer_) {
   struct ata_disk* d = d_;
   struct channel* c = d->channel;
-  lock_acquire(&c->lock);
-  select_sector(d, sec_no);
-  issue_pio_command(c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy(d))
-    PANIC("%s: disk write failed, sector=%" PRDSNu, d->name, sec_no);
-  output_sector(c, buffer);
-  sema_down(&c->completion_wait);
+  const uint8_t* buffer = buffer_;
+
+  acquire_channel(d);
+  while (cnt > 0) {
+    size_t n = cnt < MAX_COMMAND_SECTORS ? cnt : MAX_COMMAND_SECTORS;
+
+    if (use_dma(d, buffer))
+      dma_transfer(d, sec_no, n, (void*)buffer, true);
+    else
+      pio_write(d, sec_no, n, buffer);
+    buffer += n * BLOCK_SECTOR_SIZE;
+    sec_no += n;
+    cnt -= n;
+  }
   lock_release(&c->lock);
 }
 
-static struct block_operations ide_operations = {ide_read, ide_write};
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void ide_read(void* d, block_sector_t sec_no, void* buffer) {
+  ide_read_multiple(d, sec_no, 1, buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void ide_write(void* d, block_sector_t sec_no, const void* buffer) {
+  ide_write_multiple(d, sec_no, 1, buffer);
+}
+
+static struct block_operations ide_operations = {
+    .read = ide_read,
+    .write = ide_write,
+    .read_multiple = ide_read_multiple,
+    .write_multiple = ide_write_multiple,
+};
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
-static void select_sector(struct ata_disk* d, block_sector_t sec_no) {
+   writes SEC_NO and CNT to the disk's sector selection and sector
+   count registers.  (We use LBA mode.) */
+static void select_sector(struct ata_disk* d, block_sector_t sec_no, size_t cnt) {
   struct channel* c = d->channel;
 
   ASSERT(sec_no < (1UL << 28));
+  ASSERT(cnt > 0 && cnt <= MAX_COMMAND_SECTORS);
 
   select_device_wait(d);
-  outb(reg_nsect(c), 1);
+  outb(reg_nsect(c), cnt == MAX_COMMAND_SECTORS ? 0 : cnt);
   outb(reg_lbal(c), sec_no);
   outb(reg_lbam(c), sec_no >> 8);
   outb(reg_lbah(c), (sec_no >> 16));
@@ -361,7 +636,7 @@ static void select_sector(struct ata_disk* d, block_sector_t sec_no) {
 
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
-static void issue_pio_command(struct channel* c, uint8_t command) {
+static void issue_command(struct channel* c, uint8_t command) {
   /* Interrupts must be enabled or our semaphore will never be
      up'd by the completion handler. */
   ASSERT(intr_get_level() == INTR_ON);
@@ -157,7 +157,8 @@ static void found_partition(struct block* block, uint8_t part_type, block_sector
 
     snprintf(name, sizeof name, "%s%d", block_name(block), part_nr);
     snprintf(extra_info, sizeof extra_info, "%s (%02x)", partition_type_name(part_type), part_type);
-    block_register(name, type, extra_info, size, &partition_operations, p);
+    block_set_bus(block_register(name, type, extra_info, size, &partition_operations, p),
+                  block_bus(block));
   }
 }
 
@@ -271,19 +272,12 @@ static const char* partition_type_name(uint8_t type) {
   return type_names[type] != NULL ? type_names[type] : "Unknown";
 }
 
-/* Reads sector SECTOR from partition P into BUFFER, which must
-   have room for BLOCK_SECTOR_SIZE bytes. */
-static void partition_read(void* p_, block_sector_t sector, void* buffer) {
+/* Translates *SECTOR, a sector within partition P, into a
+   sector of the device that holds P, which it returns. */
+static struct block* partition_remap(void* p_, block_sector_t* sector) {
   struct partition* p = p_;
-  block_read(p->block, p->start + sector, buffer);
+  *sector += p->start;
+  return p->block;
 }
 
-/* Write sector SECTOR to partition P from BUFFER, which must
-   contain BLOCK_SECTOR_SIZE bytes.  Returns after the block has
-   acknowledged receiving the data. */
-static void partition_write(void* p_, block_sector_t sector, const void* buffer) {
-  struct partition* p = p_;
-  block_write(p->block, p->start + sector, buffer);
-}
-
-static struct block_operations partition_operations = {partition_read, partition_write};
+static struct block_operations partition_operations = {.remap = partition_remap};
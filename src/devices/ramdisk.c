@@ -0,0 +1,111 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device whose sectors are kept in memory, in pages
+   from the kernel pool.  Its contents are lost at shutdown.  It
+   is useful for running the file system without disk latency,
+   in tests and to measure the file system's own overhead. */
+
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk {
+  size_t page_cnt; /* Number of pages. */
+  uint8_t** pages; /* The pages, SECTORS_PER_PAGE sectors each. */
+};
+
+static struct block_operations ramdisk_operations;
+
+/* Creates a RAM disk of SIZE_KB kB, rounded up to a whole page,
+   and registers it as block device "ram0".  Does nothing if
+   SIZE_KB is 0.  Panics if memory runs out. */
+void ramdisk_init(size_t size_kb) {
+  struct ramdisk* rd;
+  size_t i;
+
+  if (size_kb == 0)
+    return;
+
+  rd = malloc(sizeof *rd);
+  if (rd == NULL)
+    PANIC("ramdisk: out of memory");
+  rd->page_cnt = DIV_ROUND_UP(size_kb * 1024, PGSIZE);
+  rd->pages = malloc(rd->page_cnt * sizeof *rd->pages);
+  if (rd->pages == NULL)
+    PANIC("ramdisk: out of memory");
+  for (i = 0; i < rd->page_cnt; i++) {
+    rd->pages[i] = palloc_get_page(PAL_ZERO);
+    if (rd->pages[i] == NULL)
+      PANIC("ramdisk: out of memory after %zu of %zu pages", i, rd->page_cnt);
+  }
+
+  block_register("ram0", BLOCK_RAW, "RAM disk", rd->page_cnt * SECTORS_PER_PAGE,
+                 &ramdisk_operations, rd);
+}
+
+/* Returns the address of sector SECTOR of RD. */
+static uint8_t* sector_addr(struct ramdisk* rd, block_sector_t sector) {
+  return rd->pages[sector / SECTORS_PER_PAGE] + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE;
+}
+
+/* Reads CNT sectors starting at SECTOR from RAM disk RD into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
+static void ramdisk_read_multiple(void* rd, block_sector_t sector, size_t cnt, void* buffer_) {
+  uint8_t* buffer = buffer_;
+
+  while (cnt > 0) {
+    /* Copy up to the end of the page. */
+    size_t n = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+    if (n > cnt)
+      n = cnt;
+
+    memcpy(buffer, sector_addr(rd, sector), n * BLOCK_SECTOR_SIZE);
+    buffer += n * BLOCK_SECTOR_SIZE;
+    sector += n;
+    cnt -= n;
+  }
+}
+
+/* Writes CNT sectors starting at SECTOR to RAM disk RD from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes. */
+static void ramdisk_write_multiple(void* rd, block_sector_t sector, size_t cnt,
+                                   const void* buffer_) {
+  const uint8_t* buffer = buffer_;
+
+  while (cnt > 0) {
+    /* Copy up to the end of the page. */
+    size_t n = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+    if (n > cnt)
+      n = cnt;
+
+    memcpy(sector_addr(rd, sector), buffer, n * BLOCK_SECTOR_SIZE);
+    buffer += n * BLOCK_SECTOR_SIZE;
+    sector += n;
+    cnt -= n;
+  }
+}
+
+/* Reads sector SECTOR from RAM disk RD into BUFFER. */
+static void ramdisk_read(void* rd, block_sector_t sector, void* buffer) {
+  ramdisk_read_multiple(rd, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR to RAM disk RD from BUFFER. */
+static void ramdisk_write(void* rd, block_sector_t sector, const void* buffer) {
+  ramdisk_write_multiple(rd, sector, 1, buffer);
+}
+
+static struct block_operations ramdisk_operations = {
+    .read = ramdisk_read,
+    .write = ramdisk_write,
+    .read_multiple = ramdisk_read_multiple,
+    .write_multiple = ramdisk_write_multiple,
+};
@@ -12,6 +12,7 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "filesys/filesys.h"
+#include "filesys/journal.h"
 #endif
 
 /* Keyboard control register port. */
@@ -78,7 +79,10 @@ void shutdown_power_off(void) {
   const char* p;
 
 #ifdef FILESYS
-  filesys_done();
+  if (journal_crash)
+    journal_crash_flush();
+  else
+    filesys_done();
 #endif
 
   print_stats();
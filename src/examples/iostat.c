@@ -0,0 +1,12 @@
+/* iostat.c
+
+   Prints statistics for each block device: data moved, request
+   latency and queue depth histograms, how much of the I/O was
+   sequential, and time spent waiting for the bus. */
+
+#include <syscall.h>
+
+int main(void) {
+  iostat();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,322 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Tag of a cache entry that holds no sector. */
+#define INVALID_SECTOR ((block_sector_t)-1)
+
+/* A cached disk sector. */
+struct cache_entry {
+  struct lock lock;      /* Protects the members below. */
+  block_sector_t sector; /* Sector held, or INVALID_SECTOR.
+                            Changed only while also holding cache_lock. */
+  bool valid;            /* True if DATA holds SECTOR's contents. */
+  bool dirty;            /* True if DATA must be written back. */
+  bool accessed;         /* Second-chance bit for the clock. */
+  bool pinned;           /* True if DATA is journaled metadata that may
+                            not be written back until it commits. */
+  uint8_t data[BLOCK_SECTOR_SIZE]; /* Sector contents. */
+};
+
+/* The buffer cache. */
+static struct cache_entry cache[CACHE_SIZE];
+
+/* Protects the sector tags of all entries and the clock hand.
+   Never held across disk I/O. */
+static struct lock cache_lock;
+
+/* Next entry examined by the clock algorithm. */
+static size_t clock_hand;
+
+/* Sectors waiting to be fetched by the read-ahead thread, kept
+   in a circular queue.  Requests that arrive while the queue is
+   full are dropped. */
+#define READ_AHEAD_MAX 32
+static block_sector_t read_ahead_queue[READ_AHEAD_MAX];
+static size_t read_ahead_head; /* Index of oldest request. */
+static size_t read_ahead_cnt;  /* Number of queued requests. */
+static struct lock read_ahead_lock;
+static struct condition read_ahead_ready;
+
+static thread_func read_ahead_daemon NO_RETURN;
+
+/* Initializes the buffer cache. */
+void cache_init(void) {
+  size_t i;
+
+  lock_init(&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++) {
+    struct cache_entry* e = &cache[i];
+    lock_init(&e->lock);
+    e->sector = INVALID_SECTOR;
+    e->valid = false;
+    e->dirty = false;
+    e->accessed = false;
+    e->pinned = false;
+  }
+  clock_hand = 0;
+
+  lock_init(&read_ahead_lock);
+  cond_init(&read_ahead_ready);
+  read_ahead_head = read_ahead_cnt = 0;
+  thread_create("read-ahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+}
+
+/* Returns the entry tagged with SECTOR, or a null pointer if
+   SECTOR is not cached.  The caller must hold cache_lock. */
+static struct cache_entry* lookup(block_sector_t sector) {
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Picks an entry to evict with the clock algorithm, giving
+   recently accessed entries a second chance, and returns it
+   locked.  Entries that are in use or pinned are skipped.
+   Returns a null pointer if every entry is in use.  The caller
+   must hold cache_lock. */
+static struct cache_entry* choose_victim(void) {
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++) {
+    struct cache_entry* e = &cache[clock_hand];
+    clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+    if (!lock_try_acquire(&e->lock))
+      continue;
+    if (e->pinned) {
+      lock_release(&e->lock);
+      continue;
+    }
+    if (e->sector != INVALID_SECTOR && e->accessed) {
+      e->accessed = false;
+      lock_release(&e->lock);
+      continue;
+    }
+    return e;
+  }
+  return NULL;
+}
+
+/* Returns the cache entry for SECTOR, locked, bringing SECTOR
+   into the cache if necessary.  If LOAD is false, the caller is
+   about to overwrite the entire sector, so its old contents are
+   not read from disk. */
+static struct cache_entry* cache_get(block_sector_t sector, bool load) {
+  struct cache_entry* e;
+
+  for (;;) {
+    lock_acquire(&cache_lock);
+    e = lookup(sector);
+    if (e != NULL) {
+      lock_release(&cache_lock);
+      lock_acquire(&e->lock);
+      if (e->sector == sector)
+        break;
+
+      /* Evicted while we waited for it.  Try again. */
+      lock_release(&e->lock);
+      continue;
+    }
+
+    e = choose_victim();
+    if (e == NULL) {
+      lock_release(&cache_lock);
+      thread_yield();
+      continue;
+    }
+
+    if (e->dirty) {
+      /* Write back without holding cache_lock.  E keeps its old
+         tag meanwhile, so anyone looking for the old sector waits
+         on E's lock instead of reading stale data from disk.
+         SECTOR might be brought in by someone else while we
+         write, so start over afterward. */
+      lock_release(&cache_lock);
+      block_write(fs_device, e->sector, e->data);
+      e->dirty = false;
+      lock_release(&e->lock);
+      continue;
+    }
+
+    e->sector = sector;
+    e->valid = false;
+    lock_release(&cache_lock);
+    break;
+  }
+
+  if (load && !e->valid) {
+    block_read(fs_device, sector, e->data);
+    e->valid = true;
+  }
+  e->accessed = true;
+  return e;
+}
+
+/* Reads SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void cache_read(block_sector_t sector, void* buffer) {
+  cache_read_at(sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Reads SIZE bytes starting at byte OFFSET within SECTOR into
+   BUFFER. */
+void cache_read_at(block_sector_t sector, void* buffer, size_t size, off_t offset) {
+  struct cache_entry* e;
+
+  ASSERT(offset >= 0 && offset + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get(sector, true);
+  memcpy(buffer, e->data + offset, size);
+  lock_release(&e->lock);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes,
+   like cache_read().  Sectors that are not cached, though, are
+   read from disk straight into BUFFER, each run of them with a
+   single request, and not brought into the cache, which saves a
+   copy and leaves the cache to data that is reused.  The caller
+   must ensure that no one writes the sectors meanwhile. */
+void cache_read_direct(block_sector_t sector, size_t cnt, void* buffer_) {
+  uint8_t* buffer = buffer_;
+
+  while (cnt > 0) {
+    size_t run = 0;
+
+    lock_acquire(&cache_lock);
+    while (run < cnt && lookup(sector + run) == NULL)
+      run++;
+    lock_release(&cache_lock);
+
+    if (run == 0) {
+      cache_read(sector, buffer);
+      run = 1;
+    } else
+      block_read_multiple(fs_device, sector, run, buffer);
+    sector += run;
+    buffer += run * BLOCK_SECTOR_SIZE;
+    cnt -= run;
+  }
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER into SECTOR.
+   The data reaches the disk when the entry is evicted or the
+   cache is flushed. */
+void cache_write(block_sector_t sector, const void* buffer) {
+  cache_write_at(sector, buffer, BLOCK_SECTOR_SIZE, 0);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR, starting at byte
+   OFFSET within the sector.  If META is true, the sector holds
+   file system metadata, so it is added to the running journal
+   transaction and pinned in the cache until that commits. */
+static void write_at(block_sector_t sector, const void* buffer, size_t size, off_t offset,
+                     bool meta) {
+  struct cache_entry* e;
+
+  ASSERT(offset >= 0 && offset + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get(sector, offset != 0 || size != BLOCK_SECTOR_SIZE);
+  memcpy(e->data + offset, buffer, size);
+  e->valid = true;
+  e->dirty = true;
+  if (meta) {
+    e->pinned = true;
+    journal_add(sector);
+  }
+  lock_release(&e->lock);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR, starting at byte
+   OFFSET within the sector. */
+void cache_write_at(block_sector_t sector, const void* buffer, size_t size, off_t offset) {
+  write_at(sector, buffer, size, offset, false);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes of metadata from BUFFER into
+   SECTOR, through the journal. */
+void cache_write_meta(block_sector_t sector, const void* buffer) {
+  write_at(sector, buffer, BLOCK_SECTOR_SIZE, 0, true);
+}
+
+/* Writes SIZE bytes of metadata from BUFFER into SECTOR, starting
+   at byte OFFSET within the sector, through the journal. */
+void cache_write_meta_at(block_sector_t sector, const void* buffer, size_t size, off_t offset) {
+  write_at(sector, buffer, size, offset, true);
+}
+
+/* Writes SECTOR, whose journal transaction has committed, back to
+   disk and unpins it. */
+void cache_checkpoint(block_sector_t sector) {
+  struct cache_entry* e = cache_get(sector, true);
+
+  if (e->dirty) {
+    block_write(fs_device, e->sector, e->data);
+    e->dirty = false;
+  }
+  e->pinned = false;
+  lock_release(&e->lock);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache in
+   the background.  Returns without waiting for any I/O. */
+void cache_read_ahead(block_sector_t sector) {
+  size_t i;
+
+  lock_acquire(&read_ahead_lock);
+  for (i = 0; i < read_ahead_cnt; i++)
+    if (read_ahead_queue[(read_ahead_head + i) % READ_AHEAD_MAX] == sector)
+      goto done;
+  if (read_ahead_cnt < READ_AHEAD_MAX) {
+    read_ahead_queue[(read_ahead_head + read_ahead_cnt++) % READ_AHEAD_MAX] = sector;
+    cond_signal(&read_ahead_ready, &read_ahead_lock);
+  }
+
+done:
+  lock_release(&read_ahead_lock);
+}
+
+/* Read-ahead thread.  Fetches queued sectors into the cache so
+   that a reader streaming through a file finds them there. */
+static void read_ahead_daemon(void* aux UNUSED) {
+  for (;;) {
+    struct cache_entry* e;
+    block_sector_t sector;
+
+    lock_acquire(&read_ahead_lock);
+    while (read_ahead_cnt == 0)
+      cond_wait(&read_ahead_ready, &read_ahead_lock);
+    sector = read_ahead_queue[read_ahead_head];
+    read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_MAX;
+    read_ahead_cnt--;
+    lock_release(&read_ahead_lock);
+
+    e = cache_get(sector, true);
+    lock_release(&e->lock);
+  }
+}
+
+/* Writes every dirty entry back to disk, except for metadata
+   still waiting for its journal transaction to commit. */
+void cache_flush(void) {
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++) {
+    struct cache_entry* e = &cache[i];
+
+    lock_acquire(&e->lock);
+    if (e->dirty && !e->pinned) {
+      block_write(fs_device, e->sector, e->data);
+      e->dirty = false;
+    }
+    lock_release(&e->lock);
+  }
+}
@@ -0,0 +1,23 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stddef.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Number of sectors held by the buffer cache. */
+#define CACHE_SIZE 64
+
+void cache_init(void);
+void cache_read(block_sector_t, void*);
+void cache_read_at(block_sector_t, void*, size_t size, off_t offset);
+void cache_read_direct(block_sector_t, size_t cnt, void*);
+void cache_write(block_sector_t, const void*);
+void cache_write_at(block_sector_t, const void*, size_t size, off_t offset);
+void cache_write_meta(block_sector_t, const void*);
+void cache_write_meta_at(block_sector_t, const void*, size_t size, off_t offset);
+void cache_checkpoint(block_sector_t);
+void cache_read_ahead(block_sector_t);
+void cache_flush(void);
+
+#endif /* filesys/cache.h */
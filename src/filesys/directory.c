@@ -1,28 +1,235 @@
 #include "filesys/directory.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
-#include <list.h>
+#include <hash.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir {
-  struct inode* inode; /* Backing store. */
-  off_t pos;           /* Current position. */
+  struct inode* inode;        /* Backing store. */
+  off_t pos;                  /* Current position, as a slot number. */
+  struct dir_bucket* readdir; /* Bucket dir_readdir() is in, or null. */
+  size_t readdir_bucket;      /* Number of that bucket. */
 };
 
-/* A single directory entry. */
+/* A single directory entry.  Removing an entry zeroes its
+   slot. */
 struct dir_entry {
   block_sector_t inode_sector; /* Sector number of header. */
   char name[NAME_MAX + 1];     /* Null terminated file name. */
   bool in_use;                 /* In use or free? */
 };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* On disk, a directory is an extendible hash table.
+
+   The first sector is a header giving the table's depth D.  The
+   next INDEX_SECTORS sectors are an index of 2**D bucket
+   numbers, one for each value of the top D bits of a name's
+   hash.  The buckets, one per sector, follow.  Each bucket has a
+   depth of its own, at most D, and holds every name whose hash
+   starts with the same bits as the bucket's first index slot,
+   up to the bucket's depth.  So the 2**(D - depth) index slots
+   that point to a bucket are adjacent.
+
+   A name is found by reading its index slot and then its
+   bucket.  When a name's bucket is full, the bucket splits in
+   two on the next bit of the hash, doubling the index first if
+   the bucket's depth is already D.  A split changes only the
+   header, part of the index, and the two buckets, so it fits in
+   one journal operation however large the directory is.
+   Removing an entry just clears its slot. */
+#define BUCKET_ENTRIES ((BLOCK_SECTOR_SIZE - sizeof(uint32_t)) / sizeof(struct dir_entry))
+#define INDEX_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof(uint16_t))
+#define MAX_DEPTH 10
+#define INDEX_SECTORS ((1 << MAX_DEPTH) / INDEX_PER_SECTOR)
+
+/* Most splits to make room for one new entry.  Limits the
+   sectors that dir_add() changes in one journal operation. */
+#define MAX_SPLITS 2
+
+/* Directory header, in the directory's first sector. */
+struct dir_header {
+  uint32_t depth;      /* Number of hash bits the index uses. */
+  uint32_t bucket_cnt; /* Number of buckets. */
+  uint8_t unused[BLOCK_SECTOR_SIZE - 2 * sizeof(uint32_t)];
+};
+
+/* A bucket of directory entries, one sector long. */
+struct dir_bucket {
+  struct dir_entry entries[BUCKET_ENTRIES]; /* Entries. */
+  uint32_t depth;                           /* Number of hash bits shared by entries. */
+  uint8_t unused[BLOCK_SECTOR_SIZE - BUCKET_ENTRIES * sizeof(struct dir_entry) -
+                 sizeof(uint32_t)];
+};
+
+/* Returns the byte offset of slot IDX of the index. */
+static off_t index_ofs(size_t idx) { return BLOCK_SECTOR_SIZE + idx * sizeof(uint16_t); }
+
+/* Returns the byte offset of bucket BUCKET. */
+static off_t bucket_ofs(size_t bucket) {
+  return (1 + INDEX_SECTORS + bucket) * BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the top BITS bits of NAME's hash.  Names that differ
+   only in their last characters have hashes that differ only in
+   the low bits, so the hash is first multiplied by a constant
+   derived from the golden ratio, which mixes every bit into the
+   top ones. */
+static size_t hash_prefix(const char* name, unsigned bits) {
+  uint32_t hash = hash_string(name) * 0x9e3779b9u;
+  return bits == 0 ? 0 : hash >> (32 - bits);
+}
+
+/* Reads SIZE bytes at OFS in DIR into BUFFER.  Returns true if
+   successful. */
+static bool dir_read(const struct dir* dir, void* buffer, off_t size, off_t ofs) {
+  return inode_read_at(dir->inode, buffer, size, ofs) == size;
+}
+
+/* Writes SIZE bytes from BUFFER at OFS in DIR.  Returns true if
+   successful. */
+static bool dir_write(struct dir* dir, const void* buffer, off_t size, off_t ofs) {
+  return inode_write_at(dir->inode, buffer, size, ofs) == size;
+}
+
+/* Reads DIR's header into *H, and NAME's bucket into *B, and
+   stores the bucket's number in *BUCKETP.  Returns true if
+   successful. */
+static bool find_bucket(const struct dir* dir, const char* name, struct dir_header* h,
+                        struct dir_bucket* b, size_t* bucketp) {
+  uint16_t bucket;
+
+  if (!dir_read(dir, h, sizeof *h, 0) ||
+      !dir_read(dir, &bucket, sizeof bucket, index_ofs(hash_prefix(name, h->depth))) ||
+      !dir_read(dir, b, sizeof *b, bucket_ofs(bucket)))
+    return false;
+  *bucketp = bucket;
+  return true;
+}
+
+/* Name lookup cache.
+
+   Remembers where recently used names were found, so that
+   looking up the same name again needs no directory reads at
+   all.  Entries are keyed by directory inode sector and name,
+   and each key can live in only one place. */
+#define NAME_CACHE_SIZE 128
+
+struct name_cache_entry {
+  block_sector_t dir_sector;   /* Directory inode sector. */
+  char name[NAME_MAX + 1];     /* Name, or empty if unused. */
+  block_sector_t inode_sector; /* Sector of the named inode. */
+  off_t ofs;                   /* Byte offset of the entry in the directory. */
+};
+
+static struct name_cache_entry name_cache[NAME_CACHE_SIZE];
+static struct lock name_cache_lock;
+
+/* Initializes the directory module. */
+void dir_init(void) { lock_init(&name_cache_lock); }
+
+/* Returns the name cache slot for NAME in the directory whose
+   inode is in DIR_SECTOR. */
+static struct name_cache_entry* name_cache_slot(block_sector_t dir_sector, const char* name) {
+  return &name_cache[(hash_string(name) ^ hash_int(dir_sector)) % NAME_CACHE_SIZE];
+}
+
+/* Looks up NAME in the directory whose inode is in DIR_SECTOR.
+   If it is cached, stores the entry's inode sector and byte
+   offset into *INODE_SECTOR and *OFSP and returns true.
+   Otherwise returns false. */
+static bool name_cache_lookup(block_sector_t dir_sector, const char* name,
+                              block_sector_t* inode_sector, off_t* ofsp) {
+  struct name_cache_entry* c = name_cache_slot(dir_sector, name);
+  bool found;
+
+  lock_acquire(&name_cache_lock);
+  found = c->dir_sector == dir_sector && !strcmp(c->name, name);
+  if (found) {
+    *inode_sector = c->inode_sector;
+    *ofsp = c->ofs;
+  }
+  lock_release(&name_cache_lock);
+  return found;
+}
+
+/* Records that NAME in the directory whose inode is in
+   DIR_SECTOR refers to INODE_SECTOR and is stored at byte offset
+   OFS. */
+static void name_cache_insert(block_sector_t dir_sector, const char* name,
+                              block_sector_t inode_sector, off_t ofs) {
+  struct name_cache_entry* c = name_cache_slot(dir_sector, name);
+
+  lock_acquire(&name_cache_lock);
+  c->dir_sector = dir_sector;
+  strlcpy(c->name, name, sizeof c->name);
+  c->inode_sector = inode_sector;
+  c->ofs = ofs;
+  lock_release(&name_cache_lock);
+}
+
+/* Forgets NAME in the directory whose inode is in DIR_SECTOR.
+   If NAME is a null pointer, forgets every name in that
+   directory. */
+static void name_cache_invalidate(block_sector_t dir_sector, const char* name) {
+  size_t i;
+
+  lock_acquire(&name_cache_lock);
+  if (name != NULL) {
+    struct name_cache_entry* c = name_cache_slot(dir_sector, name);
+    if (c->dir_sector == dir_sector && !strcmp(c->name, name))
+      c->name[0] = '\0';
+  } else {
+    for (i = 0; i < NAME_CACHE_SIZE; i++)
+      if (name_cache[i].dir_sector == dir_sector)
+        name_cache[i].name[0] = '\0';
+  }
+  lock_release(&name_cache_lock);
+}
+
+/* Creates a directory with space for at least ENTRY_CNT entries
+   in the given SECTOR.  Returns true if successful, false on
+   failure. */
 bool dir_create(block_sector_t sector, size_t entry_cnt) {
-  return inode_create(sector, entry_cnt * sizeof(struct dir_entry));
+  struct dir_header* h = calloc(1, sizeof *h);
+  struct dir_bucket* b = calloc(1, sizeof *b);
+  uint16_t* index = NULL;
+  struct dir* dir = NULL;
+  bool success = false;
+  size_t i;
+
+  /* Start with buckets about half full. */
+  if (h == NULL || b == NULL)
+    goto done;
+  while ((BUCKET_ENTRIES << h->depth) < 2 * entry_cnt && h->depth < MAX_DEPTH)
+    h->depth++;
+  h->bucket_cnt = 1 << h->depth;
+  b->depth = h->depth;
+  index = malloc(h->bucket_cnt * sizeof *index);
+  if (index == NULL)
+    goto done;
+  for (i = 0; i < h->bucket_cnt; i++)
+    index[i] = i;
+
+  /* SECTOR might have held a directory that was removed. */
+  name_cache_invalidate(sector, NULL);
+  if (!inode_create(sector, 0) || (dir = dir_open(inode_open(sector))) == NULL)
+    goto done;
+  success = dir_write(dir, h, sizeof *h, 0) &&
+            dir_write(dir, index, h->bucket_cnt * sizeof *index, index_ofs(0));
+  for (i = 0; success && i < h->bucket_cnt; i++)
+    success = dir_write(dir, b, sizeof *b, bucket_ofs(i));
+
+done:
+  dir_close(dir);
+  free(index);
+  free(b);
+  free(h);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -32,6 +239,7 @@ struct dir* dir_open(struct inode* inode) {
   if (inode != NULL && dir != NULL) {
     dir->inode = inode;
     dir->pos = 0;
+    inode_set_metadata(inode);
     return dir;
   } else {
     inode_close(inode);
@@ -56,6 +264,7 @@ struct dir* dir_reopen(struct dir* dir) {
 void dir_close(struct dir* dir) {
   if (dir != NULL) {
     inode_close(dir->inode);
+    free(dir->readdir);
     free(dir);
   }
 }
@@ -71,21 +280,93 @@ struct inode* dir_get_inode(struct dir* dir) {
    directory entry if OFSP is non-null.
    otherwise, returns false and ignores EP and OFSP. */
 static bool lookup(const struct dir* dir, const char* name, struct dir_entry* ep, off_t* ofsp) {
-  struct dir_entry e;
-  size_t ofs;
+  struct dir_header* h = malloc(sizeof *h);
+  struct dir_bucket* b = malloc(sizeof *b);
+  bool found = false;
+  size_t bucket, i;
 
   ASSERT(dir != NULL);
   ASSERT(name != NULL);
 
-  for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e; ofs += sizeof e)
-    if (e.in_use && !strcmp(name, e.name)) {
-      if (ep != NULL)
-        *ep = e;
-      if (ofsp != NULL)
-        *ofsp = ofs;
-      return true;
+  if (h != NULL && b != NULL && find_bucket(dir, name, h, b, &bucket))
+    for (i = 0; i < BUCKET_ENTRIES; i++) {
+      struct dir_entry* e = &b->entries[i];
+      if (e->in_use && !strcmp(name, e->name)) {
+        if (ep != NULL)
+          *ep = *e;
+        if (ofsp != NULL)
+          *ofsp = bucket_ofs(bucket) + i * sizeof *e;
+        found = true;
+        break;
+      }
     }
-  return false;
+  free(b);
+  free(h);
+  return found;
+}
+
+/* Splits bucket BUCKET of DIR, whose contents are in *B and the
+   header in *H, moving the entries whose hash has a 1 in the next
+   bit to a new bucket.  Doubles the index first if need be.
+   Updates *H.  NAME is any name that belongs in BUCKET.  Returns
+   true if successful, false if the index cannot grow or on
+   error. */
+static bool split(struct dir* dir, struct dir_header* h, struct dir_bucket* b, size_t bucket,
+                  const char* name) {
+  struct dir_bucket* nb;
+  uint16_t* index;
+  size_t new_bucket = h->bucket_cnt;
+  size_t first, half, i;
+  bool success = false;
+
+  if (b->depth == h->depth && h->depth == MAX_DEPTH)
+    return false;
+  nb = calloc(1, sizeof *nb);
+  index = malloc((2u << h->depth) * sizeof *index);
+  if (nb == NULL || index == NULL)
+    goto done;
+
+  /* Double the index if every slot pointing to BUCKET is needed. */
+  if (b->depth == h->depth) {
+    if (!dir_read(dir, index, (1u << h->depth) * sizeof *index, index_ofs(0)))
+      goto done;
+    for (i = 1u << h->depth; i-- > 0;)
+      index[2 * i] = index[2 * i + 1] = index[i];
+    h->depth++;
+    if (!dir_write(dir, index, (1u << h->depth) * sizeof *index, index_ofs(0)))
+      goto done;
+  }
+
+  /* Move entries to the new bucket. */
+  b->depth++;
+  nb->depth = b->depth;
+  for (i = 0; i < BUCKET_ENTRIES; i++) {
+    struct dir_entry* e = &b->entries[i];
+    if (e->in_use && (hash_prefix(e->name, b->depth) & 1)) {
+      nb->entries[i] = *e;
+      memset(e, 0, sizeof *e);
+    }
+  }
+
+  /* Point the second half of BUCKET's index slots at the new
+     bucket. */
+  half = 1u << (h->depth - b->depth);
+  first = hash_prefix(name, h->depth) & ~(2 * half - 1);
+  for (i = 0; i < half; i++)
+    index[i] = new_bucket;
+  h->bucket_cnt++;
+  success = dir_write(dir, nb, sizeof *nb, bucket_ofs(new_bucket)) &&
+            dir_write(dir, b, sizeof *b, bucket_ofs(bucket)) &&
+            dir_write(dir, index, half * sizeof *index, index_ofs(first + half)) &&
+            dir_write(dir, h, sizeof *h, 0);
+
+  /* Entries moved, so cached offsets are stale. */
+  name_cache_invalidate(inode_get_inumber(dir->inode), NULL);
+
+done:
+  free(index);
+  free(nb);
+  return success;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -94,14 +375,23 @@ static bool lookup(const struct dir* dir, const char* name, struct dir_entry* ep
    a null pointer.  The caller must close *INODE. */
 bool dir_lookup(const struct dir* dir, const char* name, struct inode** inode) {
   struct dir_entry e;
+  block_sector_t dir_sector;
+  block_sector_t inode_sector;
+  off_t ofs;
 
   ASSERT(dir != NULL);
   ASSERT(name != NULL);
 
-  if (lookup(dir, name, &e, NULL))
+  dir_sector = inode_get_inumber(dir->inode);
+  inode_lock(dir->inode);
+  if (name_cache_lookup(dir_sector, name, &inode_sector, &ofs))
+    *inode = inode_open(inode_sector);
+  else if (lookup(dir, name, &e, &ofs)) {
+    name_cache_insert(dir_sector, name, e.inode_sector, ofs);
     *inode = inode_open(e.inode_sector);
-  else
+  } else
     *inode = NULL;
+  inode_unlock(dir->inode);
 
   return *inode != NULL;
 }
@@ -110,11 +400,14 @@ bool dir_lookup(const struct dir* dir, const char* name, struct inode** inode) {
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), if NAME's bucket is
+   full and cannot split, or if a disk or memory error occurs. */
 bool dir_add(struct dir* dir, const char* name, block_sector_t inode_sector) {
-  struct dir_entry e;
-  off_t ofs;
+  struct dir_header* h = NULL;
+  struct dir_bucket* b = NULL;
+  struct dir_entry* e;
+  size_t bucket, slot;
+  int splits;
   bool success = false;
 
   ASSERT(dir != NULL);
@@ -124,28 +417,49 @@ bool dir_add(struct dir* dir, const char* name, block_sector_t inode_sector) {
   if (*name == '\0' || strlen(name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup(dir, name, NULL, NULL))
+  inode_lock(dir->inode);
+  h = malloc(sizeof *h);
+  b = malloc(sizeof *b);
+  if (h == NULL || b == NULL)
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e; ofs += sizeof e)
-    if (!e.in_use)
+  /* Find a free slot in NAME's bucket, splitting the bucket if
+     it is full.  NAME can only be in that bucket, so this also
+     checks that it is not in use. */
+  for (splits = 0;; splits++) {
+    size_t i;
+
+    if (!find_bucket(dir, name, h, b, &bucket))
+      goto done;
+    slot = BUCKET_ENTRIES;
+    for (i = 0; i < BUCKET_ENTRIES; i++) {
+      if (!b->entries[i].in_use) {
+        if (slot == BUCKET_ENTRIES)
+          slot = i;
+      } else if (!strcmp(name, b->entries[i].name))
+        goto done;
+    }
+    if (slot < BUCKET_ENTRIES)
       break;
+    if (splits == MAX_SPLITS || !split(dir, h, b, bucket, name))
+      goto done;
+  }
 
   /* Write slot. */
-  e.in_use = true;
-  strlcpy(e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
-  success = inode_write_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
+  e = &b->entries[slot];
+  memset(e, 0, sizeof *e);
+  e->in_use = true;
+  strlcpy(e->name, name, sizeof e->name);
+  e->inode_sector = inode_sector;
+  success = dir_write(dir, e, sizeof *e, bucket_ofs(bucket) + slot * sizeof *e);
+  if (success)
+    name_cache_insert(inode_get_inumber(dir->inode), name, inode_sector,
+                      bucket_ofs(bucket) + slot * sizeof *e);
 
 done:
+  inode_unlock(dir->inode);
+  free(b);
+  free(h);
   return success;
 }
 
@@ -162,8 +476,10 @@ bool dir_remove(struct dir* dir, const char* name) {
   ASSERT(name != NULL);
 
   /* Find directory entry. */
+  inode_lock(dir->inode);
   if (!lookup(dir, name, &e, &ofs))
     goto done;
+  name_cache_invalidate(inode_get_inumber(dir->inode), name);
 
   /* Open inode. */
   inode = inode_open(e.inode_sector);
@@ -171,8 +487,8 @@ bool dir_remove(struct dir* dir, const char* name) {
     goto done;
 
   /* Erase directory entry. */
-  e.in_use = false;
-  if (inode_write_at(dir->inode, &e, sizeof e, ofs) != sizeof e)
+  memset(&e, 0, sizeof e);
+  if (!dir_write(dir, &e, sizeof e, ofs))
     goto done;
 
   /* Remove inode. */
@@ -180,22 +496,37 @@ bool dir_remove(struct dir* dir, const char* name) {
   success = true;
 
 done:
+  inode_unlock(dir->inode);
   inode_close(inode);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  Reads each bucket only once, so
+   entries added to or removed from a bucket after DIR has moved
+   into it may or may not be seen. */
 bool dir_readdir(struct dir* dir, char name[NAME_MAX + 1]) {
-  struct dir_entry e;
+  if (dir->readdir == NULL) {
+    dir->readdir = malloc(sizeof *dir->readdir);
+    if (dir->readdir == NULL)
+      return false;
+    dir->readdir_bucket = SIZE_MAX;
+  }
 
-  while (inode_read_at(dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
-    dir->pos += sizeof e;
-    if (e.in_use) {
-      strlcpy(name, e.name, NAME_MAX + 1);
+  for (;; dir->pos++) {
+    size_t bucket = dir->pos / BUCKET_ENTRIES;
+    struct dir_entry* e = &dir->readdir->entries[dir->pos % BUCKET_ENTRIES];
+
+    if (bucket != dir->readdir_bucket) {
+      if (!dir_read(dir, dir->readdir, sizeof *dir->readdir, bucket_ofs(bucket)))
+        return false;
+      dir->readdir_bucket = bucket;
+    }
+    if (e->in_use) {
+      dir->pos++;
+      strlcpy(name, e->name, NAME_MAX + 1);
       return true;
     }
   }
-  return false;
 }
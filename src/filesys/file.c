@@ -1,13 +1,23 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
+#include "devices/block.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Number of sectors to keep fetching ahead of a sequential
+   reader. */
+#define READ_AHEAD_SECTORS 8
 
 /* An open file. */
 struct file {
   struct inode* inode; /* File's inode. */
   off_t pos;           /* Current position. */
   bool deny_write;     /* Has file_deny_write() been called? */
+  off_t last_end;      /* Position just past the previous read. */
+  off_t ahead_end;     /* End of the region already queued for read-ahead. */
+  struct lock lock;    /* Protects the position and read-ahead state,
+                          for threads sharing one open file. */
 };
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -19,6 +29,9 @@ struct file* file_open(struct inode* inode) {
     file->inode = inode;
     file->pos = 0;
     file->deny_write = false;
+    file->last_end = 0;
+    file->ahead_end = 0;
+    lock_init(&file->lock);
     return file;
   } else {
     inode_close(inode);
@@ -51,10 +64,29 @@ struct inode* file_get_inode(struct file* file) {
    starting at the file's current position.
    Returns the number of bytes actually read,
    which may be less than SIZE if end of file is reached.
-   Advances FILE's position by the number of bytes read. */
+   Advances FILE's position by the number of bytes read.
+   A read that begins where the previous one ended is taken as
+   sequential access, and the sectors that follow it are fetched
+   into the buffer cache in the background. */
 off_t file_read(struct file* file, void* buffer, off_t size) {
-  off_t bytes_read = inode_read_at(file->inode, buffer, size, file->pos);
+  bool sequential;
+  off_t bytes_read;
+
+  lock_acquire(&file->lock);
+  sequential = file->pos == file->last_end;
+  bytes_read = inode_read_at(file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  file->last_end = file->pos;
+
+  if (sequential && bytes_read > 0) {
+    off_t ahead_start = file->ahead_end > file->pos ? file->ahead_end : file->pos;
+    off_t ahead_end = file->pos + READ_AHEAD_SECTORS * BLOCK_SECTOR_SIZE;
+    if (ahead_start < ahead_end) {
+      inode_read_ahead(file->inode, ahead_start, ahead_end - ahead_start);
+      file->ahead_end = ahead_end;
+    }
+  }
+  lock_release(&file->lock);
   return bytes_read;
 }
 
@@ -70,22 +102,22 @@ off_t file_read_at(struct file* file, void* buffer, off_t size, off_t file_ofs)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the file cannot grow.
    Advances FILE's position by the number of bytes read. */
 off_t file_write(struct file* file, const void* buffer, off_t size) {
-  off_t bytes_written = inode_write_at(file->inode, buffer, size, file->pos);
+  off_t bytes_written;
+
+  lock_acquire(&file->lock);
+  bytes_written = inode_write_at(file->inode, buffer, size, file->pos);
   file->pos += bytes_written;
+  lock_release(&file->lock);
   return bytes_written;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the file cannot grow.
    The file's current position is unaffected. */
 off_t file_write_at(struct file* file, const void* buffer, off_t size, off_t file_ofs) {
   return inode_write_at(file->inode, buffer, size, file_ofs);
@@ -123,7 +155,9 @@ off_t file_length(struct file* file) {
 void file_seek(struct file* file, off_t new_pos) {
   ASSERT(file != NULL);
   ASSERT(new_pos >= 0);
+  lock_acquire(&file->lock);
   file->pos = new_pos;
+  lock_release(&file->lock);
 }
 
 /* Returns the current position in FILE as a byte offset from the
@@ -7,6 +7,7 @@
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0 /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1 /* Root directory file inode sector. */
+#define JOURNAL_SECTOR 2  /* Journal header sector. */
 
 /* Block device that contains the file system. */
 extern struct block* fs_device;
@@ -1,43 +1,193 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <string.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* The disk is divided into groups of GROUP_SECTORS sectors, and
+   the number of free sectors in each group is kept on the side so
+   that full groups can be skipped without scanning their bits. */
+#define GROUP_SECTORS 1024
+
+/* Number of sectors whose bits fit in one sector of the free map
+   file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
 
 static struct file* free_map_file; /* Free map file. */
 static struct bitmap* free_map;    /* Free map, one bit per sector. */
+static size_t* group_free_cnt;     /* Free sectors in each group. */
+static size_t group_cnt;           /* Number of groups. */
+static block_sector_t next_sector; /* Where to start searching by default. */
+static struct bitmap* dirty_map;   /* Sectors of the file that are out of date. */
+static block_sector_t* file_homes; /* Disk sector of each sector of the file. */
+static struct lock free_map_lock;  /* Protects all of the above. */
+
+/* Recomputes every group's free sector count from the bitmap. */
+static void count_groups(void) {
+  size_t sector_cnt = bitmap_size(free_map);
+  size_t g;
+
+  for (g = 0; g < group_cnt; g++) {
+    size_t start = g * GROUP_SECTORS;
+    size_t cnt = sector_cnt - start < GROUP_SECTORS ? sector_cnt - start : GROUP_SECTORS;
+    group_free_cnt[g] = bitmap_count(free_map, start, cnt, false);
+  }
+}
+
+/* Marks CNT sectors starting at SECTOR as in use if USED is true,
+   or free otherwise, keeping the group counts up to date. */
+static void set_sectors(block_sector_t sector, size_t cnt, bool used) {
+  size_t end = sector + cnt;
+
+  if (cnt == 0)
+    return;
+  bitmap_set_multiple(free_map, sector, cnt, used);
+  bitmap_set_multiple(dirty_map, sector / BITS_PER_SECTOR,
+                      (end - 1) / BITS_PER_SECTOR - sector / BITS_PER_SECTOR + 1, true);
+  while (sector < end) {
+    size_t g = sector / GROUP_SECTORS;
+    size_t group_end = (g + 1) * GROUP_SECTORS < end ? (g + 1) * GROUP_SECTORS : end;
+    size_t n = group_end - sector;
+
+    if (used)
+      group_free_cnt[g] -= n;
+    else
+      group_free_cnt[g] += n;
+    sector = group_end;
+  }
+}
 
 /* Initializes the free map. */
 void free_map_init(void) {
+  lock_init(&free_map_lock);
   free_map = bitmap_create(block_size(fs_device));
   if (free_map == NULL)
     PANIC("bitmap creation failed--file system device is too large");
+  group_cnt = DIV_ROUND_UP(bitmap_size(free_map), GROUP_SECTORS);
+  group_free_cnt = malloc(group_cnt * sizeof *group_free_cnt);
+  if (group_free_cnt == NULL)
+    PANIC("free map group creation failed");
+  dirty_map = bitmap_create(DIV_ROUND_UP(bitmap_file_size(free_map), BLOCK_SECTOR_SIZE));
+  file_homes = malloc(bitmap_size(dirty_map) * sizeof *file_homes);
+  if (dirty_map == NULL || file_homes == NULL)
+    PANIC("free map dirty map creation failed");
   bitmap_mark(free_map, FREE_MAP_SECTOR);
   bitmap_mark(free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple(free_map, JOURNAL_SECTOR, journal_size(), true);
+  count_groups();
+  next_sector = 0;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  Searches for space starting at NEAR,
+   so that related data ends up close together on disk.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
-bool free_map_allocate(size_t cnt, block_sector_t* sectorp) {
-  block_sector_t sector = bitmap_scan_and_flip(free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR && free_map_file != NULL && !bitmap_write(free_map, free_map_file)) {
-    bitmap_set_multiple(free_map, sector, cnt, false);
-    sector = BITMAP_ERROR;
-  }
-  if (sector != BITMAP_ERROR)
+   sectors were available. */
+bool free_map_allocate_near(size_t cnt, block_sector_t near, block_sector_t* sectorp) {
+  size_t sector = BITMAP_ERROR;
+  size_t first_group, i;
+
+  lock_acquire(&free_map_lock);
+  if (near >= bitmap_size(free_map))
+    near = 0;
+  first_group = near / GROUP_SECTORS;
+
+  /* Look through the groups from NEAR's onward, skipping those
+     without enough free sectors.  Runs that would cross into the
+     next group are left for the fallback below. */
+  if (cnt <= GROUP_SECTORS)
+    for (i = 0; i < group_cnt; i++) {
+      size_t g = (first_group + i) % group_cnt;
+      size_t group_end = (g + 1) * GROUP_SECTORS;
+
+      if (group_free_cnt[g] >= cnt) {
+        size_t start = i == 0 ? near : g * GROUP_SECTORS;
+        size_t s = bitmap_scan(free_map, start, cnt, false);
+        if (s != BITMAP_ERROR && s + cnt <= group_end) {
+          sector = s;
+          break;
+        }
+      }
+    }
+  if (sector == BITMAP_ERROR)
+    sector = bitmap_scan(free_map, 0, cnt, false);
+
+  if (sector != BITMAP_ERROR) {
+    set_sectors(sector, cnt, true);
+    next_sector = sector + cnt;
     *sectorp = sector;
+  }
+  lock_release(&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates CNT consecutive sectors from the free map and stores
+   the first into *SECTORP, searching from just past the previous
+   allocation.
+   Returns true if successful, false if not enough consecutive
+   sectors were available. */
+bool free_map_allocate(size_t cnt, block_sector_t* sectorp) {
+  return free_map_allocate_near(cnt, next_sector, sectorp);
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void free_map_release(block_sector_t sector, size_t cnt) {
+  lock_acquire(&free_map_lock);
   ASSERT(bitmap_all(free_map, sector, cnt));
-  bitmap_set_multiple(free_map, sector, cnt, false);
-  bitmap_write(free_map, free_map_file);
+  set_sectors(sector, cnt, false);
+  lock_release(&free_map_lock);
+}
+
+/* Hands the journal a copy of each sector of the free map file
+   whose bits have changed since it was last written, so that a
+   commit logs only those and writes them back.  The file's
+   sectors are not written through the buffer cache, where they
+   would stay pinned until commit.  Allocations and releases only
+   update the in-memory bitmap, so this must be called before
+   shutdown.
+   The journal operation is begun before taking free_map_lock,
+   because beginning it may commit, which flushes the free map. */
+void free_map_flush(void) {
+  static uint8_t buffer[BLOCK_SECTOR_SIZE];
+
+  journal_begin();
+  lock_acquire(&free_map_lock);
+  if (free_map_file != NULL) {
+    size_t size = bitmap_file_size(free_map);
+    size_t i;
+
+    for (i = 0; i < bitmap_size(dirty_map); i++)
+      if (bitmap_test(dirty_map, i)) {
+        size_t ofs = i * BLOCK_SECTOR_SIZE;
+        size_t bytes = size - ofs < BLOCK_SECTOR_SIZE ? size - ofs : BLOCK_SECTOR_SIZE;
+        memset(buffer, 0, sizeof buffer);
+        bitmap_file_image(free_map, ofs, buffer, bytes);
+        journal_add_copy(file_homes[i], buffer);
+      }
+    bitmap_set_all(dirty_map, false);
+  }
+  lock_release(&free_map_lock);
+  journal_end();
+}
+
+/* Records where each sector of the free map file is on disk.
+   They never move, because the file's sectors are all allocated
+   when it is created. */
+static void find_homes(void) {
+  struct inode* inode = file_get_inode(free_map_file);
+  size_t i;
+
+  for (i = 0; i < bitmap_size(dirty_map); i++) {
+    file_homes[i] = inode_sector_at(inode, i * BLOCK_SECTOR_SIZE);
+    if (file_homes[i] == 0 || file_homes[i] == (block_sector_t)-1)
+      PANIC("free map file is missing sector %zu", i);
+  }
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -47,22 +197,40 @@ void free_map_open(void) {
     PANIC("can't open free map");
   if (!bitmap_read(free_map, free_map_file))
     PANIC("can't read free map");
+  find_homes();
+  count_groups();
+  bitmap_set_all(dirty_map, false);
 }
 
 /* Writes the free map to disk and closes the free map file. */
-void free_map_close(void) { file_close(free_map_file); }
+void free_map_close(void) {
+  free_map_flush();
+  file_close(free_map_file);
+  free_map_file = NULL;
+}
 
 /* Creates a new free map file on disk and writes the free map to
    it. */
 void free_map_create(void) {
+  struct inode* inode;
+
   /* Create inode. */
   if (!inode_create(FREE_MAP_SECTOR, bitmap_file_size(free_map)))
     PANIC("free map creation failed");
 
+  /* Allocate the file's sectors up front, because filling a hole
+     in the free map file while flushing it would change the free
+     map in the middle of writing it out.  Their contents need not
+     be zeroed, because the flush below writes all of them. */
+  inode = inode_open(FREE_MAP_SECTOR);
+  if (inode == NULL || !inode_preallocate(inode, bitmap_file_size(free_map)))
+    PANIC("can't allocate free map");
+
   /* Write bitmap to file. */
-  free_map_file = file_open(inode_open(FREE_MAP_SECTOR));
+  free_map_file = file_open(inode);
   if (free_map_file == NULL)
     PANIC("can't open free map");
-  if (!bitmap_write(free_map, free_map_file))
-    PANIC("can't write free map");
+  find_homes();
+  bitmap_set_all(dirty_map, true);
+  free_map_flush();
 }
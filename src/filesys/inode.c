@@ -1,62 +1,253 @@
 #include "filesys/inode.h"
-#include <list.h>
 #include <debug.h>
+#include <hash.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Layout of the sector index in an on-disk inode.  The first
+   DIRECT_CNT data sectors are listed directly in the inode, the
+   next PTRS_PER_SECTOR through a single indirect sector, and the
+   rest through a doubly indirect sector. */
+#define DIRECT_CNT 124
+#define INDIRECT_IDX DIRECT_CNT            /* Index of the indirect sector. */
+#define DBL_INDIRECT_IDX (DIRECT_CNT + 1) /* Index of the doubly indirect sector. */
+#define SECTOR_CNT (DIRECT_CNT + 2)
+
+/* Number of sector numbers that fit in an index sector. */
+#define PTRS_PER_SECTOR ((size_t)(BLOCK_SECTOR_SIZE / sizeof(block_sector_t)))
+
+/* Largest file size an inode can represent, in bytes. */
+#define INODE_SPAN                                                                                 \
+  ((off_t)((DIRECT_CNT + PTRS_PER_SECTOR + PTRS_PER_SECTOR * PTRS_PER_SECTOR) * BLOCK_SECTOR_SIZE))
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   A sector number of 0 in the index means "not allocated"; sector
+   0 holds the free map's inode, so it is never file data. */
 struct inode_disk {
-  block_sector_t start; /* First data sector. */
-  off_t length;         /* File size in bytes. */
-  unsigned magic;       /* Magic number. */
-  uint32_t unused[125]; /* Not used. */
+  block_sector_t sectors[SECTOR_CNT]; /* Sector index. */
+  off_t length;                       /* File size in bytes. */
+  unsigned magic;                     /* Magic number. */
 };
 
+/* Most sectors a write allocates in one journal operation.  A
+   larger write ends its operation and begins a new one in
+   between, so that each one changes only a few index sectors. */
+#define ALLOCS_PER_OP 64
+
+/* Most data sectors a write to a metadata inode changes in one
+   journal operation.  Each one is journaled, on top of the inode
+   and up to 3 index sectors, which must all fit in OP_CREDITS. */
+#define META_SECTORS_PER_OP (OP_CREDITS - 4)
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t bytes_to_sectors(off_t size) { return DIV_ROUND_UP(size, BLOCK_SECTOR_SIZE); }
 
 /* In-memory inode. */
 struct inode {
-  struct list_elem elem;  /* Element in inode list. */
+  struct hash_elem elem;  /* Element in open_inodes. */
   block_sector_t sector;  /* Sector number of disk location. */
-  int open_cnt;           /* Number of openers. */
+  int open_cnt;           /* Number of openers, protected by open_inodes_lock. */
   bool removed;           /* True if deleted, false otherwise. */
+  bool metadata;          /* True if data is journaled as metadata. */
   int deny_write_cnt;     /* 0: writes ok, >0: deny writes. */
   struct inode_disk data; /* Inode content. */
+
+  /* Readers hold this to read the data or DATA, writers to
+     change either one or DENY_WRITE_CNT. */
+  struct rw_lock rw_lock;
+
+  /* Serializes callers' multi-step updates; see inode_lock(). */
+  struct lock lock;
 };
 
+/* A sector's worth of zeros. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
+/* Allocates a sector, searching from *NEAR, and stores its
+   number into *SECTORP.  Advances *NEAR past the new sector, so
+   that a series of allocations tends to be contiguous.  If ZERO
+   is true, also fills the sector with zeros.  Returns true if
+   successful, false if the disk is full. */
+static bool allocate_sector(block_sector_t* sectorp, block_sector_t* near, bool zero) {
+  if (!free_map_allocate_near(1, *near, sectorp))
+    return false;
+  *near = *sectorp + 1;
+  if (zero)
+    cache_write_meta(*sectorp, zeros);
+  return true;
+}
+
+/* Returns the sector number stored in *SLOT.  If it is 0 and
+   NEAR is non-null, first allocates a sector for it as
+   allocate_sector() does, zeroing it if ZERO is true.  Returns 0
+   if the slot is empty and could not be filled. */
+static block_sector_t lookup_direct(block_sector_t* slot, block_sector_t* near, bool zero) {
+  if (*slot == 0 && near != NULL)
+    allocate_sector(slot, near, zero);
+  return *slot;
+}
+
+/* Returns entry IDX of the index held in sector INDEX.  If it is
+   0 and NEAR is non-null, first allocates a sector for it as
+   allocate_sector() does, zeroing it if ZERO is true.  Returns 0
+   if the entry is empty and could not be filled. */
+static block_sector_t lookup_indirect(block_sector_t index, size_t idx, block_sector_t* near,
+                                      bool zero) {
+  block_sector_t sector;
+  off_t ofs = idx * sizeof sector;
+
+  cache_read_at(index, &sector, sizeof sector, ofs);
+  if (sector == 0 && near != NULL && allocate_sector(&sector, near, zero))
+    cache_write_meta_at(index, &sector, sizeof sector, ofs);
+  return sector;
+}
+
+/* Returns the sector that holds data sector IDX of DISK_INODE,
+   or 0 if that part of the file is a hole.  If NEAR is non-null,
+   fills the hole instead, allocating sectors from *NEAR onward
+   and advancing *NEAR past them.  Index sectors allocated on the
+   way are zeroed; the new data sector itself is left for the
+   caller to fill.  Also returns 0 if allocation fails. */
+static block_sector_t lookup_sector(struct inode_disk* disk_inode, size_t idx,
+                                    block_sector_t* near) {
+  block_sector_t index;
+
+  if (idx < DIRECT_CNT)
+    return lookup_direct(&disk_inode->sectors[idx], near, false);
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR) {
+    index = lookup_direct(&disk_inode->sectors[INDIRECT_IDX], near, true);
+    return index != 0 ? lookup_indirect(index, idx, near, false) : 0;
+  }
+  idx -= PTRS_PER_SECTOR;
+
+  ASSERT(idx < PTRS_PER_SECTOR * PTRS_PER_SECTOR);
+  index = lookup_direct(&disk_inode->sectors[DBL_INDIRECT_IDX], near, true);
+  if (index != 0)
+    index = lookup_indirect(index, idx / PTRS_PER_SECTOR, near, true);
+  return index != 0 ? lookup_indirect(index, idx % PTRS_PER_SECTOR, near, false) : 0;
+}
+
+/* Returns where to start looking for free space for data sector
+   IDX of INODE: just past the sector before it, if that one is
+   allocated, or else just past the inode itself. */
+static block_sector_t allocation_hint(struct inode* inode, size_t idx) {
+  block_sector_t prev = idx > 0 ? lookup_sector(&inode->data, idx - 1, NULL) : 0;
+  return (prev != 0 ? prev : inode->sector) + 1;
+}
+
+/* Frees the index sector INDEX and, recursively, every sector
+   it refers to.  LEVEL is 1 for an indirect sector, 2 for a
+   doubly indirect sector. */
+static void release_index(block_sector_t index, int level) {
+  size_t i;
+
+  for (i = 0; i < PTRS_PER_SECTOR; i++) {
+    block_sector_t sector = lookup_indirect(index, i, NULL, false);
+    if (sector != 0) {
+      if (level > 1)
+        release_index(sector, level - 1);
+      else
+        free_map_release(sector, 1);
+    }
+  }
+  free_map_release(index, 1);
+}
+
+/* Frees every data and index sector of DISK_INODE. */
+static void release_sectors(struct inode_disk* disk_inode) {
+  size_t i;
+
+  for (i = 0; i < DIRECT_CNT; i++)
+    if (disk_inode->sectors[i] != 0)
+      free_map_release(disk_inode->sectors[i], 1);
+  if (disk_inode->sectors[INDIRECT_IDX] != 0)
+    release_index(disk_inode->sectors[INDIRECT_IDX], 1);
+  if (disk_inode->sectors[DBL_INDIRECT_IDX] != 0)
+    release_index(disk_inode->sectors[DBL_INDIRECT_IDX], 2);
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
+   within INODE, or 0 if POS lies in a hole that has never been
+   written.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
-static block_sector_t byte_to_sector(const struct inode* inode, off_t pos) {
+static block_sector_t byte_to_sector(struct inode* inode, off_t pos) {
   ASSERT(inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    return lookup_sector(&inode->data, pos / BLOCK_SECTOR_SIZE, NULL);
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes, hashed by sector number, so that opening a single
+   inode twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Protects open_inodes and the open counts of its members.  Never
+   held across disk I/O. */
+static struct lock open_inodes_lock;
+
+static hash_hash_func open_inode_hash;
+static hash_less_func open_inode_less;
 
 /* Initializes the inode module. */
-void inode_init(void) { list_init(&open_inodes); }
+void inode_init(void) {
+  if (!hash_init(&open_inodes, open_inode_hash, open_inode_less, NULL))
+    PANIC("can't create open inode table");
+  lock_init(&open_inodes_lock);
+}
+
+/* Returns a hash value for the inode containing E. */
+static unsigned open_inode_hash(const struct hash_elem* e, void* aux UNUSED) {
+  const struct inode* inode = hash_entry(e, struct inode, elem);
+  return hash_int(inode->sector);
+}
+
+/* Returns true if the inode containing A precedes the one
+   containing B. */
+static bool open_inode_less(const struct hash_elem* a, const struct hash_elem* b,
+                            void* aux UNUSED) {
+  return hash_entry(a, struct inode, elem)->sector < hash_entry(b, struct inode, elem)->sector;
+}
+
+/* Returns the open inode for SECTOR with its open count
+   incremented, or a null pointer if SECTOR is not open.  The
+   caller must hold open_inodes_lock. */
+static struct inode* reopen_sector(block_sector_t sector) {
+  struct inode key;
+  struct hash_elem* e;
+  struct inode* inode;
+
+  key.sector = sector;
+  e = hash_find(&open_inodes, &key.elem);
+  if (e == NULL)
+    return NULL;
+  inode = hash_entry(e, struct inode, elem);
+  inode->open_cnt++;
+  return inode;
+}
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  No data sectors are allocated yet: the file starts
+   out as a hole that reads as zeros, and each sector is
+   allocated when it is first written.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails or LENGTH is too
+   big. */
 bool inode_create(block_sector_t sector, off_t length) {
   struct inode_disk* disk_inode = NULL;
   bool success = false;
@@ -68,23 +259,13 @@ bool inode_create(block_sector_t sector, off_t length) {
   ASSERT(sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
   disk_inode = calloc(1, sizeof *disk_inode);
-  if (disk_inode != NULL) {
-    size_t sectors = bytes_to_sectors(length);
+  if (disk_inode != NULL && length <= INODE_SPAN) {
     disk_inode->length = length;
     disk_inode->magic = INODE_MAGIC;
-    if (free_map_allocate(sectors, &disk_inode->start)) {
-      block_write(fs_device, sector, disk_inode);
-      if (sectors > 0) {
-        static char zeros[BLOCK_SECTOR_SIZE];
-        size_t i;
-
-        for (i = 0; i < sectors; i++)
-          block_write(fs_device, disk_inode->start + i, zeros);
-      }
-      success = true;
-    }
-    free(disk_inode);
+    cache_write_meta(sector, disk_inode);
+    success = true;
   }
+  free(disk_inode);
   return success;
 }
 
@@ -92,37 +273,51 @@ bool inode_create(block_sector_t sector, off_t length) {
    and returns a `struct inode' that contains it.
    Returns a null pointer if memory allocation fails. */
 struct inode* inode_open(block_sector_t sector) {
-  struct list_elem* e;
   struct inode* inode;
+  struct inode* open;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin(&open_inodes); e != list_end(&open_inodes); e = list_next(e)) {
-    inode = list_entry(e, struct inode, elem);
-    if (inode->sector == sector) {
-      inode_reopen(inode);
-      return inode;
-    }
-  }
+  lock_acquire(&open_inodes_lock);
+  inode = reopen_sector(sector);
+  lock_release(&open_inodes_lock);
+  if (inode != NULL)
+    return inode;
 
-  /* Allocate memory. */
+  /* Allocate memory and read the inode without holding the lock,
+     so that opens of other inodes can proceed meanwhile. */
   inode = malloc(sizeof *inode);
   if (inode == NULL)
     return NULL;
-
-  /* Initialize. */
-  list_push_front(&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read(fs_device, inode->sector, &inode->data);
+  inode->metadata = false;
+  rw_lock_init(&inode->rw_lock);
+  lock_init(&inode->lock);
+  cache_read(inode->sector, &inode->data);
+
+  /* Someone else may have opened the same inode while we read
+     it.  If so, use theirs. */
+  lock_acquire(&open_inodes_lock);
+  open = reopen_sector(sector);
+  if (open == NULL)
+    hash_insert(&open_inodes, &inode->elem);
+  lock_release(&open_inodes_lock);
+  if (open != NULL) {
+    free(inode);
+    inode = open;
+  }
   return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode* inode_reopen(struct inode* inode) {
-  if (inode != NULL)
+  if (inode != NULL) {
+    lock_acquire(&open_inodes_lock);
     inode->open_cnt++;
+    lock_release(&open_inodes_lock);
+  }
   return inode;
 }
 
@@ -133,19 +328,24 @@ block_sector_t inode_get_inumber(const struct inode* inode) { return inode->sect
    If this was the last reference to INODE, frees its memory.
    If INODE was also a removed inode, frees its blocks. */
 void inode_close(struct inode* inode) {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0) {
-    /* Remove from inode list and release lock. */
-    list_remove(&inode->elem);
+  lock_acquire(&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete(&open_inodes, &inode->elem);
+  lock_release(&open_inodes_lock);
 
+  if (last) {
     /* Deallocate blocks if removed. */
     if (inode->removed) {
       free_map_release(inode->sector, 1);
-      free_map_release(inode->data.start, bytes_to_sectors(inode->data.length));
+      release_sectors(&inode->data);
     }
 
     free(inode);
@@ -165,15 +365,15 @@ void inode_remove(struct inode* inode) {
 off_t inode_read_at(struct inode* inode, void* buffer_, off_t size, off_t offset) {
   uint8_t* buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t* bounce = NULL;
 
+  rw_lock_acquire(&inode->rw_lock, RW_READER);
   while (size > 0) {
     /* Disk sector to read, starting byte offset within sector. */
     block_sector_t sector_idx = byte_to_sector(inode, offset);
     int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
     /* Bytes left in inode, bytes left in sector, lesser of the two. */
-    off_t inode_left = inode_length(inode) - offset;
+    off_t inode_left = inode->data.length - offset;
     int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
     int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -182,106 +382,261 @@ off_t inode_read_at(struct inode* inode, void* buffer_, off_t size, off_t offset
     if (chunk_size <= 0)
       break;
 
-    if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE) {
-      /* Read full sector directly into caller's buffer. */
-      block_read(fs_device, sector_idx, buffer + bytes_read);
-    } else {
-      /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-      if (bounce == NULL) {
-        bounce = malloc(BLOCK_SECTOR_SIZE);
-        if (bounce == NULL)
-          break;
-      }
-      block_read(fs_device, sector_idx, bounce);
-      memcpy(buffer + bytes_read, bounce + sector_ofs, chunk_size);
-    }
+    /* Copy the chunk out of the buffer cache.  Whole sectors that
+       are not cached go straight from disk into BUFFER, as many
+       as are contiguous on disk at a time.  Holes read as zeros
+       without touching the disk.  Holding the inode's lock keeps
+       writers away meanwhile. */
+    if (sector_idx == 0)
+      memset(buffer + bytes_read, 0, chunk_size);
+    else if (chunk_size == BLOCK_SECTOR_SIZE) {
+      size_t run = 1;
+
+      while ((off_t)(run + 1) * BLOCK_SECTOR_SIZE <= size &&
+             (off_t)(run + 1) * BLOCK_SECTOR_SIZE <= inode_left &&
+             byte_to_sector(inode, offset + run * BLOCK_SECTOR_SIZE) == sector_idx + run)
+        run++;
+      chunk_size = run * BLOCK_SECTOR_SIZE;
+      cache_read_direct(sector_idx, run, buffer + bytes_read);
+    } else
+      cache_read_at(sector_idx, buffer + bytes_read, chunk_size, sector_ofs);
 
     /* Advance. */
     size -= chunk_size;
     offset += chunk_size;
     bytes_read += chunk_size;
   }
-  free(bounce);
+  rw_lock_release(&inode->rw_lock, RW_READER);
 
   return bytes_read;
 }
 
+/* Queues the sectors holding the SIZE bytes of INODE starting at
+   OFFSET to be read into the buffer cache in the background.
+   Bytes past the end of INODE are ignored. */
+void inode_read_ahead(struct inode* inode, off_t offset, off_t size) {
+  off_t end;
+
+  rw_lock_acquire(&inode->rw_lock, RW_READER);
+  end = offset + size < inode->data.length ? offset + size : inode->data.length;
+  for (offset = ROUND_DOWN(offset, BLOCK_SECTOR_SIZE); offset < end; offset += BLOCK_SECTOR_SIZE) {
+    block_sector_t sector = byte_to_sector(inode, offset);
+    if (sector != 0)
+      cache_read_ahead(sector);
+  }
+  rw_lock_release(&inode->rw_lock, RW_READER);
+}
+
+/* Returns how many data sectors a write to INODE may allocate,
+   or if INODE holds metadata, write, in one journal operation. */
+static int sectors_per_op(const struct inode* inode) {
+  return inode->metadata ? META_SECTORS_PER_OP : ALLOCS_PER_OP;
+}
+
+/* Writes SIZE bytes from BUFFER into data sector SECTOR of INODE,
+   starting at byte OFFSET within the sector, through the journal
+   if INODE holds metadata. */
+static void write_data(struct inode* inode, block_sector_t sector, const void* buffer, size_t size,
+                       off_t offset) {
+  if (inode->metadata)
+    cache_write_meta_at(sector, buffer, size, offset);
+  else
+    cache_write_at(sector, buffer, size, offset);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Extends INODE if the write ends past end of file, and
+   allocates sectors for any holes written.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up, the write would exceed
+   the largest possible file, or an error occurs. */
 off_t inode_write_at(struct inode* inode, const void* buffer_, off_t size, off_t offset) {
   const uint8_t* buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t* bounce = NULL;
-
-  if (inode->deny_write_cnt)
+  bool inode_changed = false;
+  block_sector_t near = 0;
+  int op_cnt = 0;
+  int op_max = sectors_per_op(inode);
+
+  rw_lock_acquire(&inode->rw_lock, RW_WRITER);
+  if (inode->deny_write_cnt) {
+    rw_lock_release(&inode->rw_lock, RW_WRITER);
     return 0;
+  }
+  journal_begin();
+
+  if (size > INODE_SPAN - offset)
+    size = INODE_SPAN - offset;
 
   while (size > 0) {
     /* Sector to write, starting byte offset within sector. */
-    block_sector_t sector_idx = byte_to_sector(inode, offset);
+    size_t sector_nr = offset / BLOCK_SECTOR_SIZE;
+    block_sector_t sector_idx = lookup_sector(&inode->data, sector_nr, NULL);
     int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-    /* Bytes left in inode, bytes left in sector, lesser of the two. */
-    off_t inode_left = inode_length(inode) - offset;
+    /* Number of bytes to actually write into this sector.  Bytes
+       past end of file count too, since the file grows to cover
+       them. */
     int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-    int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-    /* Number of bytes to actually write into this sector. */
-    int chunk_size = size < min_left ? size : min_left;
-    if (chunk_size <= 0)
-      break;
-
-    if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE) {
-      /* Write full sector directly to disk. */
-      block_write(fs_device, sector_idx, buffer + bytes_written);
-    } else {
-      /* We need a bounce buffer. */
-      if (bounce == NULL) {
-        bounce = malloc(BLOCK_SECTOR_SIZE);
-        if (bounce == NULL)
-          break;
-      }
+    int chunk_size = size < sector_left ? size : sector_left;
+
+    /* Start a new journal operation once this one has allocated,
+       or for a metadata inode written, as many sectors as it may.
+       Sectors allocated past end of file are harmless, so this is
+       a consistent point to commit at.  A write to a metadata
+       inode that spans more than one operation is not atomic as a
+       whole, but no caller makes one. */
+    if ((sector_idx == 0 || inode->metadata) && op_cnt++ == op_max) {
+      if (inode_changed)
+        cache_write_meta(inode->sector, &inode->data);
+      journal_end();
+      journal_begin();
+      op_cnt = 1;
+    }
 
-      /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-      if (sector_ofs > 0 || chunk_size < sector_left)
-        block_read(fs_device, sector_idx, bounce);
-      else
-        memset(bounce, 0, BLOCK_SECTOR_SIZE);
-      memcpy(bounce + sector_ofs, buffer + bytes_written, chunk_size);
-      block_write(fs_device, sector_idx, bounce);
+    if (sector_idx == 0) {
+      /* First write to this part of the file.  Allocate its
+         sector now, zeroing whatever part of it the chunk leaves
+         uncovered so that those bytes read back as zeros. */
+      if (near == 0)
+        near = allocation_hint(inode, sector_nr);
+      sector_idx = lookup_sector(&inode->data, sector_nr, &near);
+      if (sector_idx == 0)
+        break;
+      if (chunk_size < BLOCK_SECTOR_SIZE)
+        write_data(inode, sector_idx, zeros, BLOCK_SECTOR_SIZE, 0);
+      inode_changed = true;
     }
 
+    /* Write the chunk into the buffer cache, which reads in the
+       rest of the sector first if the chunk does not cover it. */
+    write_data(inode, sector_idx, buffer + bytes_written, chunk_size, sector_ofs);
+
     /* Advance. */
     size -= chunk_size;
     offset += chunk_size;
     bytes_written += chunk_size;
   }
-  free(bounce);
+
+  if (offset > inode->data.length) {
+    inode->data.length = offset;
+    inode_changed = true;
+  }
+  if (inode_changed)
+    cache_write_meta(inode->sector, &inode->data);
+  journal_end();
+  rw_lock_release(&inode->rw_lock, RW_WRITER);
 
   return bytes_written;
 }
 
+/* Allocates sectors for every hole in the first LENGTH bytes of
+   INODE, zeroing them if ZERO is true.  A last sector that LENGTH
+   only partly covers is always zeroed.  Does not change INODE's
+   length.  Returns true if successful, false if the disk fills
+   up. */
+static bool reserve(struct inode* inode, off_t length, bool zero) {
+  size_t sector_cnt = bytes_to_sectors(length);
+  size_t sector_nr;
+  block_sector_t near = inode->sector + 1;
+  bool success = true;
+  int op_cnt = 0;
+  int op_max = sectors_per_op(inode);
+
+  ASSERT(length >= 0 && length <= INODE_SPAN);
+
+  rw_lock_acquire(&inode->rw_lock, RW_WRITER);
+  journal_begin();
+  for (sector_nr = 0; sector_nr < sector_cnt; sector_nr++)
+    if (lookup_sector(&inode->data, sector_nr, NULL) == 0) {
+      block_sector_t sector;
+
+      if (op_cnt++ == op_max) {
+        cache_write_meta(inode->sector, &inode->data);
+        journal_end();
+        journal_begin();
+        op_cnt = 1;
+      }
+      sector = lookup_sector(&inode->data, sector_nr, &near);
+      if (sector == 0) {
+        success = false;
+        break;
+      }
+      if (zero || (sector_nr == sector_cnt - 1 && length % BLOCK_SECTOR_SIZE != 0))
+        write_data(inode, sector, zeros, BLOCK_SECTOR_SIZE, 0);
+    }
+  cache_write_meta(inode->sector, &inode->data);
+  journal_end();
+  rw_lock_release(&inode->rw_lock, RW_WRITER);
+  return success;
+}
+
+/* Allocates zeroed sectors for every hole in the first LENGTH
+   bytes of INODE, so that later writes there need not allocate
+   anything.  Does not change INODE's length.  Returns true if
+   successful, false if the disk fills up. */
+bool inode_reserve(struct inode* inode, off_t length) { return reserve(inode, length, true); }
+
+/* Like inode_reserve(), but leaves the contents of the sectors it
+   allocates undefined, except for a partly covered last sector.
+   For a caller that is about to overwrite all of the first
+   LENGTH bytes anyway, this saves zeroing each sector in the
+   cache and possibly writing the zeros to disk. */
+bool inode_preallocate(struct inode* inode, off_t length) { return reserve(inode, length, false); }
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void inode_deny_write(struct inode* inode) {
+  rw_lock_acquire(&inode->rw_lock, RW_WRITER);
   inode->deny_write_cnt++;
   ASSERT(inode->deny_write_cnt <= inode->open_cnt);
+  rw_lock_release(&inode->rw_lock, RW_WRITER);
 }
 
 /* Re-enables writes to INODE.
    Must be called once by each inode opener who has called
    inode_deny_write() on the inode, before closing the inode. */
 void inode_allow_write(struct inode* inode) {
+  rw_lock_acquire(&inode->rw_lock, RW_WRITER);
   ASSERT(inode->deny_write_cnt > 0);
   ASSERT(inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rw_lock_release(&inode->rw_lock, RW_WRITER);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
-off_t inode_length(const struct inode* inode) { return inode->data.length; }
+off_t inode_length(struct inode* inode) {
+  off_t length;
+
+  rw_lock_acquire(&inode->rw_lock, RW_READER);
+  length = inode->data.length;
+  rw_lock_release(&inode->rw_lock, RW_READER);
+  return length;
+}
+
+/* Returns the sector that holds byte OFFSET of INODE's data, or
+   -1 if OFFSET is past end of file.  Returns 0 if that part of
+   the file is a hole. */
+block_sector_t inode_sector_at(struct inode* inode, off_t offset) {
+  block_sector_t sector;
+
+  rw_lock_acquire(&inode->rw_lock, RW_READER);
+  sector = byte_to_sector(inode, offset);
+  rw_lock_release(&inode->rw_lock, RW_READER);
+  return sector;
+}
+
+/* Marks INODE as holding file system metadata, such as a
+   directory, so that writes to its data go through the journal
+   along with writes to the inode itself. */
+void inode_set_metadata(struct inode* inode) { inode->metadata = true; }
+
+/* Acquires INODE's mutex, which callers use to make a sequence
+   of reads and writes on INODE atomic, as directories do when
+   they look up a name and then add or remove it.  Reads and
+   writes on INODE lock it for themselves, so they may be made
+   while holding it. */
+void inode_lock(struct inode* inode) { lock_acquire(&inode->lock); }
+
+/* Releases INODE's mutex. */
+void inode_unlock(struct inode* inode) { lock_release(&inode->lock); }
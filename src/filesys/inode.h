@@ -15,9 +15,16 @@ block_sector_t inode_get_inumber(const struct inode*);
 void inode_close(struct inode*);
 void inode_remove(struct inode*);
 off_t inode_read_at(struct inode*, void*, off_t size, off_t offset);
+void inode_read_ahead(struct inode*, off_t offset, off_t size);
 off_t inode_write_at(struct inode*, const void*, off_t size, off_t offset);
+bool inode_reserve(struct inode*, off_t length);
+bool inode_preallocate(struct inode*, off_t length);
 void inode_deny_write(struct inode*);
 void inode_allow_write(struct inode*);
-off_t inode_length(const struct inode*);
+off_t inode_length(struct inode*);
+block_sector_t inode_sector_at(struct inode*, off_t offset);
+void inode_set_metadata(struct inode*);
+void inode_lock(struct inode*);
+void inode_unlock(struct inode*);
 
 #endif /* filesys/inode.h */
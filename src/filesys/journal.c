@@ -0,0 +1,396 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include <stdint.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Write-ahead journal for file system metadata.
+
+   Inodes, index sectors, directories and the free map are
+   metadata.  Writes to them go through the buffer cache as usual,
+   but the cache also hands each such sector to journal_add(),
+   which records it in the running transaction, and keeps it from
+   being written back until the transaction commits.
+
+   Operations that change metadata run between journal_begin()
+   and journal_end().  A transaction collects the changes of many
+   operations and commits them all at once, when it fills up, when
+   the journal thread wakes up, or at shutdown.  Committing waits
+   for the operations in progress to finish and holds off new
+   ones, so that the metadata it writes is consistent.  Then it:
+
+     1. Adds the changed parts of the free map to the transaction
+        and writes all dirty file data to disk, so that committed
+        metadata never points to unwritten data.
+
+     2. Copies each metadata sector in the transaction to the log,
+        and lists their home locations in the sectors between the
+        header and the log.
+
+     3. Writes a header giving the number of sectors in the log.
+        Once this write completes, the transaction has committed.
+
+     4. Writes each metadata sector to its home location.
+
+     5. Clears the header.
+
+   If the system crashes before step 3, none of the transaction
+   reaches disk.  After step 3, journal_init() replays the log at
+   the next boot, so all of it does.  Either way the metadata on
+   disk is consistent, without scanning the whole disk.
+
+   The free map is not kept pinned in the buffer cache.  Instead,
+   step 1 hands the journal a copy of each changed sector of the
+   free map file through journal_add_copy(), and the journal logs
+   and writes back the copies itself.  So only the sectors of a
+   transaction proper stay pinned, which keeps them well below
+   CACHE_SIZE however large the free map is.
+
+   The free map can change anywhere between commits, so the log
+   has room for all of it on top of a full transaction.  Its size
+   depends only on the size of the device, so formatting and every
+   later boot agree on where the journal ends.
+
+   To test replay, the kernel command-line option -crash sets
+   journal_crash.  Then nothing commits on a timer, and shutdown
+   calls journal_crash_flush() instead of filesys_done(), which
+   stops after step 3 as if the power failed there. */
+
+/* Magic number for a journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Most sectors a transaction holds, not counting the free map,
+   before new operations wait for it to commit. */
+#define TX_SECTORS 32
+
+/* Most sectors from the buffer cache that a transaction may hold
+   at all: TX_SECTORS, plus room for operations nested inside
+   others, which take no credits of their own.  Every one stays
+   pinned in the cache until commit, so this must be well below
+   CACHE_SIZE. */
+#define TX_MAX_SECTORS (TX_SECTORS + OP_CREDITS)
+
+/* Number of home locations listed in each sector after the
+   header. */
+#define HOMES_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof(block_sector_t))
+
+/* Most sectors copied to or from the log with one request. */
+#define LOG_BATCH 32
+
+/* Interval between commits by the journal thread, in ticks. */
+#define COMMIT_INTERVAL (5 * TIMER_FREQ)
+
+/* On-disk journal header, in sector JOURNAL_SECTOR.  It is
+   followed by HOME_SECTORS sectors that list the home of each
+   logged sector, and then by the LOG_SECTORS sectors of the log.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header {
+  unsigned magic;      /* JOURNAL_MAGIC. */
+  uint32_t sector_cnt; /* Sectors in the log, 0 if none. */
+  uint8_t unused[BLOCK_SECTOR_SIZE - 8];
+};
+
+/* Layout of the journal on disk. */
+static size_t log_sectors;  /* Sectors in the log. */
+static size_t home_sectors; /* Sectors listing the home of each logged sector. */
+
+/* The running transaction.  TX is written out as is to the
+   sectors after the header, so it has room for HOME_SECTORS full
+   sectors of homes.  At commit, the homes of the copies are
+   appended to the TX_CNT sectors in the buffer cache. */
+static block_sector_t* tx;                   /* Sectors changed. */
+static size_t tx_cnt;                        /* Number of sectors in TX. */
+static block_sector_t* copy_sectors;         /* Home of each copy. */
+static uint8_t (*copies)[BLOCK_SECTOR_SIZE]; /* Copies of free map sectors. */
+static size_t copy_max;                      /* Room in COPIES. */
+static size_t copy_cnt;                      /* Number of copies. */
+
+static struct lock journal_lock;  /* Protects the variables below, TX and COPIES. */
+static struct condition tx_ready; /* Signaled when a commit ends or active
+                                     operations drop to zero. */
+static int active_cnt;            /* Operations in progress. */
+static bool commit_wanted;        /* True if journal_flush() is waiting. */
+static struct thread* committer;  /* Thread committing, if any. */
+static bool crashing;             /* True to stop committing after step 3. */
+static unsigned op_total;         /* Operations started since boot. */
+static unsigned commit_total;     /* Transactions committed since boot. */
+
+/* If true, shutdown leaves the last transaction in the log
+   instead of writing it home.  Set by the -crash option. */
+bool journal_crash;
+
+/* Header and log buffers, used only by the committer or by
+   journal_init(). */
+static struct journal_header header;
+static uint8_t log_buffer[LOG_BATCH][BLOCK_SECTOR_SIZE];
+
+static thread_func journal_daemon NO_RETURN;
+static void commit(void);
+
+/* Returns the first sector of the log. */
+static block_sector_t log_start(void) { return JOURNAL_SECTOR + 1 + home_sectors; }
+
+/* Writes the header to disk. */
+static void write_header(void) { block_write(fs_device, JOURNAL_SECTOR, &header); }
+
+/* Returns the number of sectors in the free map file. */
+static size_t free_map_sectors(void) {
+  size_t bitmap_bytes = ROUND_UP(DIV_ROUND_UP(block_size(fs_device), 8), sizeof(unsigned long));
+  return DIV_ROUND_UP(bitmap_bytes, BLOCK_SECTOR_SIZE);
+}
+
+/* Returns the number of sectors in the log: enough for a full
+   transaction plus every sector of the free map file. */
+static size_t count_log_sectors(void) { return TX_MAX_SECTORS + free_map_sectors(); }
+
+/* Returns the number of sectors that the journal occupies on the
+   file system device, starting at JOURNAL_SECTOR. */
+size_t journal_size(void) {
+  size_t log_cnt = count_log_sectors();
+  return 1 + DIV_ROUND_UP(log_cnt, HOMES_PER_SECTOR) + log_cnt;
+}
+
+/* Redoes the transaction in the log, if it committed before the
+   system went down. */
+static void replay(void) {
+  size_t i, j;
+
+  ASSERT(sizeof header == BLOCK_SECTOR_SIZE);
+
+  block_read(fs_device, JOURNAL_SECTOR, &header);
+  if (header.magic != JOURNAL_MAGIC || header.sector_cnt > log_sectors)
+    return;
+  block_read_multiple(fs_device, JOURNAL_SECTOR + 1,
+                      DIV_ROUND_UP(header.sector_cnt, HOMES_PER_SECTOR), tx);
+  for (i = 0; i < header.sector_cnt; i += LOG_BATCH) {
+    size_t n = header.sector_cnt - i < LOG_BATCH ? header.sector_cnt - i : LOG_BATCH;
+    block_read_multiple(fs_device, log_start() + i, n, log_buffer);
+    for (j = 0; j < n; j++)
+      block_write(fs_device, tx[i + j], log_buffer[j]);
+  }
+  if (header.sector_cnt > 0)
+    printf("journal: replayed %" PRIu32 " sectors\n", header.sector_cnt);
+}
+
+/* Initializes the journal.  Unless FORMAT is true, first replays
+   any committed transaction left in the log.  Must be called
+   before anything reads file system metadata. */
+void journal_init(bool format) {
+  log_sectors = count_log_sectors();
+  home_sectors = DIV_ROUND_UP(log_sectors, HOMES_PER_SECTOR);
+  if (journal_size() > block_size(fs_device) - JOURNAL_SECTOR)
+    PANIC("file system device is too small for the journal");
+  copy_max = free_map_sectors();
+  tx = malloc(home_sectors * BLOCK_SECTOR_SIZE);
+  copy_sectors = malloc(copy_max * sizeof *copy_sectors);
+  copies = malloc(copy_max * sizeof *copies);
+  if (tx == NULL || copy_sectors == NULL || copies == NULL)
+    PANIC("can't allocate journal transaction");
+
+  lock_init(&journal_lock);
+  cond_init(&tx_ready);
+  tx_cnt = 0;
+  copy_cnt = 0;
+  active_cnt = 0;
+  commit_wanted = false;
+  committer = NULL;
+
+  if (!format)
+    replay();
+  memset(&header, 0, sizeof header);
+  header.magic = JOURNAL_MAGIC;
+  write_header();
+
+  if (!journal_crash)
+    thread_create("journal", PRI_DEFAULT, journal_daemon, NULL);
+}
+
+/* Returns true if the running transaction might not have room
+   for one more operation. */
+static bool tx_full(void) { return tx_cnt + (active_cnt + 1) * OP_CREDITS > TX_SECTORS; }
+
+/* Commits the running transaction.  The caller must hold
+   journal_lock, no operations may be in progress, and no other
+   commit may be running.  Releases journal_lock while writing. */
+static void commit_locked(void) {
+  struct thread* cur = thread_current();
+
+  ASSERT(lock_held_by_current_thread(&journal_lock));
+  ASSERT(active_cnt == 0 && committer == NULL);
+
+  /* Writing out the free map starts operations of its own,
+     which must not wait for this commit. */
+  committer = cur;
+  cur->journal_depth++;
+  lock_release(&journal_lock);
+  commit();
+  lock_acquire(&journal_lock);
+  cur->journal_depth--;
+  committer = NULL;
+  tx_cnt = 0;
+  copy_cnt = 0;
+  commit_wanted = false;
+  cond_broadcast(&tx_ready, &journal_lock);
+}
+
+/* Writes out the running transaction, as described at the top of
+   this file.  Called only by commit_locked(). */
+static void commit(void) {
+  size_t i, j;
+
+  /* Step 1. */
+  free_map_flush();
+  cache_flush();
+  if (tx_cnt + copy_cnt == 0)
+    return;
+
+  /* Steps 2 and 3.  The copies follow the cached sectors. */
+  for (i = 0; i < tx_cnt; i += LOG_BATCH) {
+    size_t n = tx_cnt - i < LOG_BATCH ? tx_cnt - i : LOG_BATCH;
+    for (j = 0; j < n; j++)
+      cache_read(tx[i + j], log_buffer[j]);
+    block_write_multiple(fs_device, log_start() + i, n, log_buffer);
+  }
+  if (copy_cnt > 0)
+    block_write_multiple(fs_device, log_start() + tx_cnt, copy_cnt, copies);
+  memcpy(tx + tx_cnt, copy_sectors, copy_cnt * sizeof *copy_sectors);
+  block_write_multiple(fs_device, JOURNAL_SECTOR + 1,
+                       DIV_ROUND_UP(tx_cnt + copy_cnt, HOMES_PER_SECTOR), tx);
+  header.sector_cnt = tx_cnt + copy_cnt;
+  write_header();
+  commit_total++;
+  if (crashing) {
+    printf("journal: %u operations in %u commits, crashing after the last\n", op_total,
+           commit_total);
+    return;
+  }
+
+  /* Steps 4 and 5.  The copies go through the cache too, so that
+     it never holds a stale version of their sectors. */
+  for (i = 0; i < tx_cnt; i++)
+    cache_checkpoint(tx[i]);
+  for (i = 0; i < copy_cnt; i++) {
+    cache_write(copy_sectors[i], copies[i]);
+    cache_checkpoint(copy_sectors[i]);
+  }
+  header.sector_cnt = 0;
+  write_header();
+}
+
+/* Starts an operation that changes metadata, waiting if the
+   running transaction is full or committing.  Operations nest:
+   only the outermost begin and end of a thread count. */
+void journal_begin(void) {
+  struct thread* cur = thread_current();
+
+  if (cur->journal_depth++ > 0)
+    return;
+
+  lock_acquire(&journal_lock);
+  while (committer != NULL || commit_wanted || tx_full()) {
+    if (committer == NULL && active_cnt == 0)
+      commit_locked();
+    else
+      cond_wait(&tx_ready, &journal_lock);
+  }
+  active_cnt++;
+  op_total++;
+  lock_release(&journal_lock);
+}
+
+/* Ends an operation started by journal_begin().  The last
+   operation to end commits the transaction if it is full or a
+   commit has been requested. */
+void journal_end(void) {
+  struct thread* cur = thread_current();
+
+  ASSERT(cur->journal_depth > 0);
+  if (--cur->journal_depth > 0)
+    return;
+
+  lock_acquire(&journal_lock);
+  if (--active_cnt == 0) {
+    if (commit_wanted || tx_full())
+      commit_locked();
+    else
+      cond_broadcast(&tx_ready, &journal_lock);
+  }
+  lock_release(&journal_lock);
+}
+
+/* Adds SECTOR to the running transaction.  Called by the buffer
+   cache whenever metadata is written. */
+void journal_add(block_sector_t sector) {
+  size_t i;
+
+  lock_acquire(&journal_lock);
+  for (i = 0; i < tx_cnt; i++)
+    if (tx[i] == sector)
+      goto done;
+  if (tx_cnt >= TX_MAX_SECTORS)
+    PANIC("journal transaction overflow");
+  tx[tx_cnt++] = sector;
+
+done:
+  lock_release(&journal_lock);
+}
+
+/* Adds SECTOR to the running transaction with the contents in
+   DATA, which is copied, replacing any earlier copy of SECTOR.
+   Used for the free map, whose sectors are not kept pinned in
+   the buffer cache.  The caller must be in an operation started
+   by journal_begin(). */
+void journal_add_copy(block_sector_t sector, const void* data) {
+  size_t i;
+
+  lock_acquire(&journal_lock);
+  for (i = 0; i < copy_cnt; i++)
+    if (copy_sectors[i] == sector)
+      break;
+  if (i == copy_cnt) {
+    if (copy_cnt >= copy_max)
+      PANIC("journal transaction overflow");
+    copy_sectors[copy_cnt++] = sector;
+  }
+  memcpy(copies[i], data, BLOCK_SECTOR_SIZE);
+  lock_release(&journal_lock);
+}
+
+/* Commits the running transaction, waiting for operations in
+   progress to finish first. */
+void journal_flush(void) {
+  lock_acquire(&journal_lock);
+  commit_wanted = true;
+  while (committer != NULL || active_cnt > 0)
+    cond_wait(&tx_ready, &journal_lock);
+  if (commit_wanted)
+    commit_locked();
+  lock_release(&journal_lock);
+}
+
+/* Commits the running transaction like journal_flush(), but
+   leaves it in the log without writing it home, for
+   journal_init() to replay at the next boot.  Used at shutdown
+   in place of filesys_done() when journal_crash is true. */
+void journal_crash_flush(void) {
+  crashing = true;
+  journal_flush();
+}
+
+/* Journal thread.  Commits periodically, so that metadata changes
+   reach disk even when transactions fill up slowly. */
+static void journal_daemon(void* aux UNUSED) {
+  for (;;) {
+    timer_sleep(COMMIT_INTERVAL);
+    journal_flush();
+  }
+}
@@ -0,0 +1,24 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Most sectors a single operation may add to a transaction.
+   Operations that might touch more, such as large writes, end
+   and begin again in between. */
+#define OP_CREDITS 8
+
+extern bool journal_crash;
+
+size_t journal_size(void);
+void journal_init(bool format);
+void journal_begin(void);
+void journal_end(void);
+void journal_add(block_sector_t);
+void journal_add_copy(block_sector_t, const void*);
+void journal_flush(void);
+void journal_crash_flush(void);
+
+#endif /* filesys/journal.h */
@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -284,6 +285,13 @@ bool bitmap_write(const struct bitmap* b, struct file* file) {
   off_t size = byte_cnt(b->bit_cnt);
   return file_write_at(file, b->bits, size, 0) == size;
 }
+
+/* Copies the SIZE bytes at byte offset OFS in the file image of
+   B, as written by bitmap_write(), into BUFFER. */
+void bitmap_file_image(const struct bitmap* b, size_t ofs, void* buffer, size_t size) {
+  ASSERT(ofs <= byte_cnt(b->bit_cnt) && size <= byte_cnt(b->bit_cnt) - ofs);
+  memcpy(buffer, (const uint8_t*)b->bits + ofs, size);
+}
 #endif /* FILESYS */
 
 /* Debugging. */
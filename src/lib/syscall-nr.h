@@ -39,7 +39,16 @@ enum {
   SYS_MKDIR,   /* Create a directory. */
   SYS_READDIR, /* Reads a directory entry. */
   SYS_ISDIR,   /* Tests if a fd represents a directory. */
-  SYS_INUMBER  /* Returns the inode number for a fd. */
+  SYS_INUMBER, /* Returns the inode number for a fd. */
+
+  /* Diagnostics. */
+  SYS_IOSTAT, /* Prints block device statistics. */
+
+  /* Process cloning. */
+  SYS_FORK, /* Clone the current process. */
+
+  /* Heap management. */
+  SYS_SBRK /* Moves the end of the heap. */
 };
 
 #endif /* lib/syscall-nr.h */
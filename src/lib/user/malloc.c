@@ -0,0 +1,429 @@
+#include <malloc.h>
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+
+/* A malloc() for user programs, built on sbrk().
+
+   As in the kernel's malloc(), the size of each request is
+   rounded up to a power of 2 and assigned to the "descriptor"
+   that manages blocks of that size.  Blocks are carved out of
+   one-page "arenas", which are obtained by growing the heap with
+   sbrk(), and a block's arena is found by rounding its address
+   down to a page boundary.  These arenas are never given back.
+
+   To keep the common case out of the kernel and free of
+   contention, each thread has a cache of free blocks for each
+   descriptor.  malloc() and free() work on the calling thread's
+   cache alone, and only take the descriptor's lock to move a
+   batch of blocks between the cache and the descriptor's free
+   list, when the cache runs empty or grows too big.  User locks
+   are system calls, so the descriptors use spinlocks instead,
+   which are never held across a system call.  Growing and
+   shrinking the heap is a system call anyway, so that uses a
+   user lock.
+
+   A thread's cache is found from its stack pointer, since the
+   kernel gives the main thread and each other thread a stack of
+   its own at a fixed place in the address space.  Code running
+   on any other stack uses the descriptors' free lists directly.
+
+   Blocks bigger than 1 kB get an arena of their own, made of as
+   many contiguous pages as needed.  When a big block is freed,
+   its arena is given back with sbrk() if it is at the end of the
+   heap, and otherwise kept for reuse by a later big block. */
+
+/* User address space layout, as set up by userprog/process.c.
+   The main thread's stack is the MAX_STACK_PAGES pages just
+   below PHYS_BASE.  The thread with stack offset K, which is
+   less than CACHE_CNT, has the single page K pages below that. */
+#define PHYS_BASE ((uintptr_t)0xc0000000)
+#define PGSIZE 4096
+#define MAX_STACK_PAGES (1 << 11)
+#define STACK_BOTTOM (PHYS_BASE - MAX_STACK_PAGES * PGSIZE)
+#define CACHE_CNT 256
+
+/* Descriptor. */
+struct desc {
+  size_t block_size;       /* Size of each element in bytes. */
+  size_t blocks_per_arena; /* Number of blocks in an arena. */
+  struct block* free_list; /* Free blocks not in any cache. */
+  volatile int lock;       /* Spinlock protecting free_list. */
+};
+
+/* Magic number for detecting arena corruption. */
+#define ARENA_MAGIC 0x9a548eed
+
+/* Arena. */
+struct arena {
+  unsigned magic;     /* Always set to ARENA_MAGIC. */
+  struct desc* desc;  /* Owning descriptor, null for big block. */
+  size_t page_cnt;    /* Number of pages. */
+  struct arena* next; /* Next free big arena. */
+};
+
+/* Free block. */
+struct block {
+  struct block* next; /* Next free block. */
+};
+
+/* Our set of descriptors, for blocks of 16 bytes up to 1 kB. */
+#define DESC(SIZE) {SIZE, (PGSIZE - sizeof(struct arena)) / (SIZE), NULL, 0}
+static struct desc descs[] = {DESC(16),  DESC(32),  DESC(64),  DESC(128),
+                              DESC(256), DESC(512), DESC(1024)};
+#define DESC_CNT (sizeof descs / sizeof *descs)
+
+/* A thread's cache of free blocks.  A cache holds up to twice
+   the number of blocks in an arena for each descriptor, and
+   moves them to and from the descriptor an arena's worth at a
+   time. */
+struct cache {
+  struct block* free_list[DESC_CNT]; /* Free blocks for each descriptor. */
+  size_t free_cnt[DESC_CNT];         /* Number of blocks in each list. */
+};
+
+/* Caches, indexed by stack offset, with the main thread's at 0. */
+static struct cache caches[CACHE_CNT];
+
+/* Free big arenas, and a spinlock that protects them. */
+static struct arena* big_arenas;
+static volatile int big_lock;
+
+/* User lock that serializes growing and shrinking the heap, and
+   its state: HEAP_LOCK_NONE at first, HEAP_LOCK_INIT while the
+   first thread to need it initializes it, then HEAP_LOCK_READY,
+   or HEAP_LOCK_FAILED if no user lock is available. */
+static lock_t heap_lock;
+static volatile int heap_lock_state;
+#define HEAP_LOCK_NONE 0
+#define HEAP_LOCK_INIT 1
+#define HEAP_LOCK_READY 2
+#define HEAP_LOCK_FAILED 3
+
+static struct arena* block_to_arena(struct block*);
+static struct block* arena_to_block(struct arena*, size_t idx);
+
+/* Acquires spinlock LOCK, waiting until it is free. */
+static void spin_lock(volatile int* lock) {
+  while (__sync_lock_test_and_set(lock, 1))
+    continue;
+}
+
+/* Releases spinlock LOCK. */
+static void spin_unlock(volatile int* lock) { __sync_lock_release(lock); }
+
+/* Acquires heap_lock, initializing it on first use.  The lock is
+   initialized only when the heap first grows, so that programs
+   that never call malloc() don't use up a user lock.  Returns
+   false if no user lock is available. */
+static bool heap_lock_acquire(void) {
+  if (heap_lock_state != HEAP_LOCK_READY) {
+    if (__sync_bool_compare_and_swap(&heap_lock_state, HEAP_LOCK_NONE, HEAP_LOCK_INIT))
+      heap_lock_state = lock_init(&heap_lock) ? HEAP_LOCK_READY : HEAP_LOCK_FAILED;
+    else {
+      /* Another thread is initializing the lock.  This happens
+         at most once per process. */
+      while (heap_lock_state == HEAP_LOCK_INIT)
+        continue;
+    }
+    if (heap_lock_state != HEAP_LOCK_READY)
+      return false;
+  }
+  lock_acquire(&heap_lock);
+  return true;
+}
+
+/* Returns the calling thread's cache, or a null pointer if it is
+   not running on a stack that the kernel set up. */
+static struct cache* thread_cache(void) {
+  uintptr_t esp = (uintptr_t)&esp;
+  size_t offset;
+
+  if (esp >= STACK_BOTTOM)
+    return &caches[0];
+  offset = (STACK_BOTTOM - 1 - esp) / PGSIZE + 1;
+  return offset < CACHE_CNT ? &caches[offset] : NULL;
+}
+
+/* Grows the heap by PAGE_CNT pages, starting at a page boundary,
+   and returns the first of them, or a null pointer if the heap
+   cannot grow that far. */
+static void* get_pages(size_t page_cnt) {
+  uintptr_t brk;
+  size_t pad;
+  uint8_t* p = NULL;
+
+  if (!heap_lock_acquire())
+    return NULL;
+  brk = (uintptr_t)sbrk(0);
+  pad = ROUND_UP(brk, PGSIZE) - brk;
+  if (page_cnt <= (INTPTR_MAX - pad) / PGSIZE) {
+    p = sbrk(pad + page_cnt * PGSIZE);
+    p = p != (void*)-1 ? p + pad : NULL;
+  }
+  lock_release(&heap_lock);
+  return p;
+}
+
+/* Adds the blocks from LIST through TAIL to descriptor D's free
+   list. */
+static void give_blocks(struct desc* d, struct block* list, struct block* tail) {
+  spin_lock(&d->lock);
+  tail->next = d->free_list;
+  d->free_list = list;
+  spin_unlock(&d->lock);
+}
+
+/* Allocates a new arena for descriptor D and adds its blocks to
+   D's free list.  Returns true if successful, false if the heap
+   cannot grow. */
+static bool new_arena(struct desc* d) {
+  struct arena* a;
+  size_t i;
+
+  a = get_pages(1);
+  if (a == NULL)
+    return false;
+
+  a->magic = ARENA_MAGIC;
+  a->desc = d;
+  a->page_cnt = 1;
+  for (i = 0; i + 1 < d->blocks_per_arena; i++)
+    arena_to_block(a, i)->next = arena_to_block(a, i + 1);
+  give_blocks(d, arena_to_block(a, 0), arena_to_block(a, i));
+  return true;
+}
+
+/* Removes up to COUNT blocks from descriptor D's free list,
+   allocating a new arena if the list is empty, and returns them
+   as a list, storing the number removed into *TAKEN.  Returns a
+   null pointer if no block is available. */
+static struct block* take_blocks(struct desc* d, size_t count, size_t* taken) {
+  struct block *list, *b;
+  size_t n;
+
+  spin_lock(&d->lock);
+  while (d->free_list == NULL) {
+    spin_unlock(&d->lock);
+    if (!new_arena(d))
+      return NULL;
+    spin_lock(&d->lock);
+  }
+  list = d->free_list;
+  for (b = list, n = 1; n < count && b->next != NULL; b = b->next)
+    n++;
+  d->free_list = b->next;
+  b->next = NULL;
+  spin_unlock(&d->lock);
+
+  *taken = n;
+  return list;
+}
+
+/* Allocates a big block of SIZE bytes in an arena of its own.
+   Returns a null pointer if memory is not available. */
+static void* big_alloc(size_t size) {
+  struct arena **ap, **best = NULL;
+  struct arena* a;
+  size_t page_cnt;
+
+  if (size > INTPTR_MAX - 2 * PGSIZE)
+    return NULL;
+  page_cnt = DIV_ROUND_UP(size + sizeof *a, PGSIZE);
+
+  /* Reuse the smallest free big arena that is big enough. */
+  spin_lock(&big_lock);
+  for (ap = &big_arenas; *ap != NULL; ap = &(*ap)->next)
+    if ((*ap)->page_cnt >= page_cnt && (best == NULL || (*ap)->page_cnt < (*best)->page_cnt))
+      best = ap;
+  a = NULL;
+  if (best != NULL) {
+    a = *best;
+    *best = a->next;
+  }
+  spin_unlock(&big_lock);
+
+  /* Otherwise, grow the heap. */
+  if (a == NULL) {
+    a = get_pages(page_cnt);
+    if (a == NULL)
+      return NULL;
+    a->magic = ARENA_MAGIC;
+    a->desc = NULL;
+    a->page_cnt = page_cnt;
+  }
+  return a + 1;
+}
+
+/* Frees big arena A, shrinking the heap if A is at its end. */
+static void big_free(struct arena* a) {
+  if (heap_lock_acquire()) {
+    bool at_end = (uint8_t*)a + a->page_cnt * PGSIZE == sbrk(0);
+    if (at_end)
+      sbrk(-(intptr_t)(a->page_cnt * PGSIZE));
+    lock_release(&heap_lock);
+    if (at_end)
+      return;
+  }
+
+  spin_lock(&big_lock);
+  a->next = big_arenas;
+  big_arenas = a;
+  spin_unlock(&big_lock);
+}
+
+/* Obtains and returns a new block of at least SIZE bytes.
+   Returns a null pointer if memory is not available. */
+void* malloc(size_t size) {
+  struct desc* d;
+  struct cache* c;
+  struct block* b;
+  size_t i, taken;
+
+  /* A null pointer satisfies a request for 0 bytes. */
+  if (size == 0)
+    return NULL;
+
+  /* Find the smallest descriptor that satisfies a SIZE-byte
+     request. */
+  for (d = descs; d < descs + DESC_CNT; d++)
+    if (d->block_size >= size)
+      break;
+  if (d == descs + DESC_CNT)
+    return big_alloc(size);
+
+  c = thread_cache();
+  if (c == NULL)
+    return take_blocks(d, 1, &taken);
+
+  /* Refill the cache if it is empty, then take a block from it. */
+  i = d - descs;
+  if (c->free_list[i] == NULL) {
+    c->free_list[i] = take_blocks(d, d->blocks_per_arena, &c->free_cnt[i]);
+    if (c->free_list[i] == NULL)
+      return NULL;
+  }
+  b = c->free_list[i];
+  c->free_list[i] = b->next;
+  c->free_cnt[i]--;
+  return b;
+}
+
+/* Allocates and return A times B bytes initialized to zeroes.
+   Returns a null pointer if memory is not available. */
+void* calloc(size_t a, size_t b) {
+  void* p;
+  size_t size;
+
+  /* Calculate block size and make sure it fits in size_t. */
+  if (b != 0 && a > SIZE_MAX / b)
+    return NULL;
+  size = a * b;
+
+  /* Allocate and zero memory. */
+  p = malloc(size);
+  if (p != NULL)
+    memset(p, 0, size);
+
+  return p;
+}
+
+/* Returns the number of bytes allocated for BLOCK. */
+static size_t block_size(void* block) {
+  struct block* b = block;
+  struct arena* a = block_to_arena(b);
+  struct desc* d = a->desc;
+
+  return d != NULL ? d->block_size : PGSIZE * a->page_cnt - sizeof *a;
+}
+
+/* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
+   moving it in the process.
+   If successful, returns the new block; on failure, returns a
+   null pointer.
+   A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+void* realloc(void* old_block, size_t new_size) {
+  if (new_size == 0) {
+    free(old_block);
+    return NULL;
+  } else if (old_block != NULL && new_size <= block_size(old_block)) {
+    /* Already big enough. */
+    return old_block;
+  } else {
+    void* new_block = malloc(new_size);
+    if (old_block != NULL && new_block != NULL) {
+      memcpy(new_block, old_block, block_size(old_block));
+      free(old_block);
+    }
+    return new_block;
+  }
+}
+
+/* Frees block P, which must have been previously allocated with
+   malloc(), calloc(), or realloc(). */
+void free(void* p) {
+  struct block* b = p;
+  struct arena* a;
+  struct desc* d;
+  struct cache* c;
+  size_t i;
+
+  if (p == NULL)
+    return;
+  a = block_to_arena(b);
+  d = a->desc;
+  if (d == NULL) {
+    big_free(a);
+    return;
+  }
+
+  c = thread_cache();
+  if (c == NULL) {
+    give_blocks(d, b, b);
+    return;
+  }
+
+  /* Add the block to the cache, and if the cache has grown too
+     big, give an arena's worth of blocks back to the descriptor
+     for other threads to use. */
+  i = d - descs;
+  b->next = c->free_list[i];
+  c->free_list[i] = b;
+  if (++c->free_cnt[i] > 2 * d->blocks_per_arena) {
+    struct block* tail = b;
+    size_t n;
+
+    for (n = 1; n < d->blocks_per_arena; n++)
+      tail = tail->next;
+    c->free_list[i] = tail->next;
+    c->free_cnt[i] -= d->blocks_per_arena;
+    give_blocks(d, b, tail);
+  }
+}
+
+/* Returns the arena that block B is inside. */
+static struct arena* block_to_arena(struct block* b) {
+  struct arena* a = (struct arena*)((uintptr_t)b & ~(uintptr_t)(PGSIZE - 1));
+
+  /* Check that the arena is valid. */
+  ASSERT(a != NULL);
+  ASSERT(a->magic == ARENA_MAGIC);
+
+  /* Check that the block is properly aligned for the arena. */
+  ASSERT(a->desc == NULL || ((uintptr_t)b - (uintptr_t)a - sizeof *a) % a->desc->block_size == 0);
+  ASSERT(a->desc != NULL || (uintptr_t)b - (uintptr_t)a == sizeof *a);
+
+  return a;
+}
+
+/* Returns the (IDX - 1)'th block within arena A. */
+static struct block* arena_to_block(struct arena* a, size_t idx) {
+  ASSERT(a != NULL);
+  ASSERT(a->magic == ARENA_MAGIC);
+  ASSERT(idx < a->desc->blocks_per_arena);
+  return (struct block*)((uint8_t*)a + sizeof *a + idx * a->desc->block_size);
+}
@@ -158,3 +158,9 @@ void sema_up(sema_t* sema) {
 }
 
 tid_t get_tid(void) { return syscall0(SYS_GET_TID); }
+
+void iostat(void) { syscall0(SYS_IOSTAT); }
+
+pid_t fork(void) { return (pid_t)syscall0(SYS_FORK); }
+
+void* sbrk(intptr_t increment) { return (void*)syscall1(SYS_SBRK, increment); }
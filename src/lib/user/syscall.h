@@ -2,6 +2,7 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <debug.h>
 #include <pthread.h>
 
@@ -62,4 +63,13 @@ bool readdir(int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir(int fd);
 int inumber(int fd);
 
+/* Diagnostics. */
+void iostat(void);
+
+/* Process cloning. */
+pid_t fork(void);
+
+/* Heap management. */
+void* sbrk(intptr_t increment);
+
 #endif /* lib/user/syscall.h */
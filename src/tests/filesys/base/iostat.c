@@ -0,0 +1,22 @@
+/* Prints block device statistics with iostat, writes and reads
+   back a file larger than the buffer cache, and prints them
+   again.  The check compares the two reports. */
+
+#include <syscall.h>
+#include "tests/filesys/seq-test.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define TEST_SIZE (96 * 1024)
+
+static char buf[TEST_SIZE];
+
+static size_t return_block_size(void) { return 4096; }
+
+void test_main(void) {
+  msg("iostat before I/O");
+  iostat();
+  seq_test("data", buf, sizeof buf, sizeof buf, return_block_size, NULL);
+  msg("iostat after I/O");
+  iostat();
+}
@@ -0,0 +1,48 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+my (@expected) = split ("\n", <<'EOF');
+(iostat) begin
+(iostat) iostat before I/O
+(iostat) create "data"
+(iostat) open "data"
+(iostat) writing "data"
+(iostat) close "data"
+(iostat) open "data" for verification
+(iostat) verified contents of "data"
+(iostat) close "data"
+(iostat) iostat after I/O
+(iostat) end
+EOF
+my (@msgs) = grep (/^\(iostat\) /, @output);
+fail "Test messages differ from expected:\n", map ("$_\n", @msgs)
+  if join ("\n", @msgs) ne join ("\n", @expected);
+
+# Add up reads, writes, and latency histogram counts over all
+# devices in each of the two reports.
+my (@reports);
+foreach (@output) {
+    if (/^\(iostat\) iostat (before|after) I\/O$/) {
+	push (@reports, {READS => 0, WRITES => 0, LATENCY => 0});
+    } elsif (@reports && /^\S+ \(.*\): (\d+) reads, (\d+) writes$/) {
+	$reports[-1]{READS} += $1;
+	$reports[-1]{WRITES} += $2;
+    } elsif (@reports && /^\s+latency:(.*)$/) {
+	my ($line) = $1;
+	$reports[-1]{LATENCY} += $_ foreach $line =~ /:(\d+)/g;
+    }
+}
+my ($before, $after) = @reports;
+foreach my $key ('READS', 'WRITES', 'LATENCY') {
+    fail "\L$key\E count did not go up: $before->{$key} before I/O, "
+      . "$after->{$key} after\n"
+      if $after->{$key} <= $before->{$key};
+}
+pass;
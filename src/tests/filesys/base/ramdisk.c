@@ -0,0 +1,21 @@
+/* Runs with the file system on a RAM disk, made with the
+   -ramdisk option and formatted at boot.  Writes a file, reads
+   it back, and prints block device statistics so that the check
+   can see the RAM disk being used. */
+
+#include <syscall.h>
+#include "tests/filesys/seq-test.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define TEST_SIZE (48 * 1024)
+
+static char buf[TEST_SIZE];
+
+static size_t return_block_size(void) { return 1234; }
+
+void test_main(void) {
+  seq_test("data", buf, sizeof buf, 0, return_block_size, NULL);
+  msg("iostat");
+  iostat();
+}
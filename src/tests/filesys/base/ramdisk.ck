@@ -0,0 +1,33 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+fail "File system is not on the RAM disk\n"
+  if !grep ($_ eq 'filesys: using ram0', @output);
+@output = get_core_output ("run", @output);
+
+my (@expected) = split ("\n", <<'EOF');
+(ramdisk) begin
+(ramdisk) create "data"
+(ramdisk) open "data"
+(ramdisk) writing "data"
+(ramdisk) close "data"
+(ramdisk) open "data" for verification
+(ramdisk) verified contents of "data"
+(ramdisk) close "data"
+(ramdisk) iostat
+(ramdisk) end
+EOF
+my (@msgs) = grep (/^\(ramdisk\) /, @output);
+fail "Test messages differ from expected:\n", map ("$_\n", @msgs)
+  if join ("\n", @msgs) ne join ("\n", @expected);
+
+my ($ram0) = grep (/^ram0 \(.*\): \d+ reads, \d+ writes$/, @output);
+fail "iostat did not list ram0\n" if !defined $ram0;
+my ($reads, $writes) = $ram0 =~ /(\d+) reads, (\d+) writes$/;
+fail "RAM disk was not read and written: $ram0\n" if !$reads || !$writes;
+pass;
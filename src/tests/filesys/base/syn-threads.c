@@ -0,0 +1,134 @@
+/* Runs several threads of one process at once, each writing and
+   then reading back its own file while all of them also read a
+   shared file, and verifies everything they read.
+
+   The threads do no synchronization of their own, so the file
+   system is free to run their I/O concurrently.  To measure how
+   it scales, the test times one thread on its own and then
+   THREAD_CNT threads together, and prints both.  Each thread does
+   the same work, so if the threads' I/O overlaps, the second run
+   takes less than THREAD_CNT times as long as the first.
+
+   Timings vary from run to run, so the test passes as long as
+   every thread reads back what it should. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include <pthread.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 8
+#define FILE_SIZE 8192
+#define CHUNK_SIZE 512
+#define ROUNDS 4
+
+static char shared[FILE_SIZE];
+static char bufs[THREAD_CNT][FILE_SIZE];
+static char shared_bufs[THREAD_CNT][FILE_SIZE];
+static int ids[THREAD_CNT];
+
+/* Returns the byte that thread ID stores at offset OFS of its
+   file. */
+static char pattern(int id, size_t ofs) { return (ofs * 31 + id * 7 + 1) & 0xff; }
+
+static void worker(void* id_) {
+  int id = *(int*)id_;
+  char* buf = bufs[id];
+  char name[16];
+  int fd, shared_fd, round;
+  size_t ofs;
+
+  snprintf(name, sizeof name, "file%d", id);
+  if (!create(name, 0))
+    fail("create \"%s\"", name);
+  if ((fd = open(name)) < 2)
+    fail("open \"%s\"", name);
+  if ((shared_fd = open("shared")) < 2)
+    fail("open \"shared\"");
+
+  for (ofs = 0; ofs < FILE_SIZE; ofs++)
+    buf[ofs] = pattern(id, ofs);
+
+  for (round = 0; round < ROUNDS; round++) {
+    /* Write our own file a chunk at a time, interleaved with
+       reads of the shared file. */
+    seek(fd, 0);
+    seek(shared_fd, 0);
+    for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE) {
+      if (write(fd, buf + ofs, CHUNK_SIZE) != CHUNK_SIZE)
+        fail("write \"%s\" at %zu", name, ofs);
+      if (read(shared_fd, shared_bufs[id] + ofs, CHUNK_SIZE) != CHUNK_SIZE)
+        fail("read \"shared\" at %zu", ofs);
+    }
+    if (memcmp(shared_bufs[id], shared, FILE_SIZE))
+      fail("\"shared\" corrupted in thread %d", id);
+
+    /* Read our own file back. */
+    memset(buf, 0, FILE_SIZE);
+    seek(fd, 0);
+    if (read(fd, buf, FILE_SIZE) != FILE_SIZE)
+      fail("read \"%s\"", name);
+    for (ofs = 0; ofs < FILE_SIZE; ofs++)
+      if (buf[ofs] != pattern(id, ofs))
+        fail("\"%s\" corrupted at %zu", name, ofs);
+  }
+
+  close(shared_fd);
+  close(fd);
+}
+
+/* Returns the processor's time-stamp counter.  There is no
+   system call for the time, but user programs may read it. */
+static uint64_t read_tsc(void) {
+  uint64_t tsc;
+  asm volatile("rdtsc" : "=A"(tsc));
+  return tsc;
+}
+
+/* Runs CNT workers at once and waits for them, then removes
+   their files.  Returns the number of time-stamp counter cycles
+   that the workers took. */
+static uint64_t run_workers(int cnt) {
+  tid_t tids[THREAD_CNT];
+  uint64_t start, cycles;
+  int i;
+
+  msg("run %d thread%s", cnt, cnt == 1 ? "" : "s");
+  start = read_tsc();
+  for (i = 0; i < cnt; i++) {
+    ids[i] = i;
+    tids[i] = pthread_check_create(worker, &ids[i]);
+  }
+  for (i = 0; i < cnt; i++)
+    pthread_check_join(tids[i]);
+  cycles = read_tsc() - start;
+
+  for (i = 0; i < cnt; i++) {
+    char name[16];
+    snprintf(name, sizeof name, "file%d", i);
+    if (!remove(name))
+      fail("remove \"%s\"", name);
+  }
+  return cycles;
+}
+
+void test_main(void) {
+  uint64_t one, all;
+  size_t i;
+  int fd;
+
+  for (i = 0; i < FILE_SIZE; i++)
+    shared[i] = i % 251;
+  CHECK(create("shared", FILE_SIZE), "create \"shared\"");
+  CHECK((fd = open("shared")) > 1, "open \"shared\"");
+  CHECK(write(fd, shared, FILE_SIZE) == FILE_SIZE, "write \"shared\"");
+  close(fd);
+
+  one = run_workers(1);
+  all = run_workers(THREAD_CNT);
+  msg("timing: 1 thread: %llu kcycles, %d threads: %llu kcycles", one / 1000, THREAD_CNT,
+      all / 1000);
+}
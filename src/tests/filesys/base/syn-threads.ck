@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# The timings vary, so leave them out of the comparison.
+@output = grep (!/^\(syn-threads\) timing: /, @output);
+compare_output ("run", IGNORE_EXIT_CODES => 1, \@output, [<<'EOF']);
+(syn-threads) begin
+(syn-threads) create "shared"
+(syn-threads) open "shared"
+(syn-threads) write "shared"
+(syn-threads) run 1 thread
+(syn-threads) run 8 threads
+(syn-threads) end
+EOF
+pass;
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+
+# The test run crashed with a transaction in the journal, so this
+# boot must have replayed it.
+fail "Journal was not replayed at boot\n"
+  if !grep (/^journal: replayed \d+ sectors$/, read_text_file ("$test.output"));
+check_archive ({'a' => {'b' => ["\0" x 512]}, 'c' => ["x" x 512]});
+pass;
@@ -0,0 +1,23 @@
+/* Makes a directory and a few files, then exits.  The test runs
+   with the -crash kernel option, so the last transaction is left
+   in the journal at shutdown and only reaches its home sectors
+   when the journal is replayed at the next boot. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[512];
+
+void test_main(void) {
+  int fd;
+
+  CHECK(mkdir("a"), "mkdir \"a\"");
+  CHECK(create("a/b", 512), "create \"a/b\"");
+  CHECK(create("c", 0), "create \"c\"");
+  CHECK((fd = open("c")) > 1, "open \"c\"");
+  memset(buf, 'x', sizeof buf);
+  CHECK(write(fd, buf, sizeof buf) == sizeof buf, "write \"c\"");
+  close(fd);
+}
@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(journal-replay) begin
+(journal-replay) mkdir "a"
+(journal-replay) create "a/b"
+(journal-replay) create "c"
+(journal-replay) open "c"
+(journal-replay) write "c"
+(journal-replay) end
+EOF
+
+our ($test);
+
+# The kernel stopped after committing its last transaction.  Each
+# commit should have carried several operations at once.
+my (@crash) = grep (/^journal: \d+ operations in \d+ commits/, read_text_file ("$test.output"));
+fail "Kernel did not crash after a journal commit\n" if @crash != 1;
+my ($ops, $commits) = $crash[0] =~ /^journal: (\d+) operations in (\d+) commits/;
+fail "$ops operations took $commits commits: journal commits are not grouped\n"
+  if $ops < 2 * $commits;
+pass;
@@ -0,0 +1,86 @@
+/* Benchmarks reading from two block devices at once.  Reads the
+   same number of sectors from the file system device and from
+   the swap device, or the scratch device if there is no swap
+   device, first from one and then the other, and then from both
+   at the same time.  If the devices are on different IDE
+   channels, the concurrent run should take about as long as the
+   longer of the two sequential ones, rather than their sum.
+
+   Timings vary from run to run, so the test passes as long as
+   every read completes. */
+
+#include <debug.h>
+#include <stdint.h>
+#include "tests/userprog/kernel/tests.h"
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Sectors read from each device, and sectors per request. */
+#define SECTORS 2048
+#define REQUEST_SECTORS 8
+
+/* A thread reading one device. */
+struct reader {
+  struct block* block;   /* Device to read. */
+  struct semaphore done; /* Up'd when the reader finishes. */
+};
+
+/* Reads up to SECTORS sectors sequentially from BLOCK. */
+static void read_device(struct block* block) {
+  uint8_t* buffer = palloc_get_page(PAL_ASSERT);
+  block_sector_t size = block_size(block);
+  block_sector_t sector;
+
+  for (sector = 0; sector + REQUEST_SECTORS <= size && sector < SECTORS;
+       sector += REQUEST_SECTORS)
+    block_read_multiple(block, sector, REQUEST_SECTORS, buffer);
+  palloc_free_page(buffer);
+}
+
+static void reader_thread(void* reader_) {
+  struct reader* reader = reader_;
+  read_device(reader->block);
+  sema_up(&reader->done);
+}
+
+/* Returns the number of milliseconds since THEN. */
+static int64_t elapsed_ms(int64_t then) { return timer_elapsed(then) * 1000 / TIMER_FREQ; }
+
+void test_io_channels(void) {
+  struct block* fs = block_get_role(BLOCK_FILESYS);
+  struct block* other = block_get_role(BLOCK_SWAP);
+  struct reader readers[2];
+  int64_t start, sequential;
+  int i;
+
+  if (other == NULL)
+    other = block_get_role(BLOCK_SCRATCH);
+  if (fs == NULL || other == NULL) {
+    msg("need a file system device and a swap or scratch device");
+    pass();
+    return;
+  }
+  msg("reading %s and %s, %s", block_name(fs), block_name(other),
+      block_bus(fs) == block_bus(other) ? "on the same bus" : "on different buses");
+
+  start = timer_ticks();
+  read_device(fs);
+  read_device(other);
+  sequential = elapsed_ms(start);
+
+  start = timer_ticks();
+  readers[0].block = fs;
+  readers[1].block = other;
+  for (i = 0; i < 2; i++) {
+    sema_init(&readers[i].done, 0);
+    thread_create(block_name(readers[i].block), PRI_DEFAULT, reader_thread, &readers[i]);
+  }
+  for (i = 0; i < 2; i++)
+    sema_down(&readers[i].done);
+  msg("sequential: %lld ms, concurrent: %lld ms", sequential, elapsed_ms(start));
+
+  pass();
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+# The timings vary, so only check that the benchmark ran to the end.
+fail "missing PASS in output\n" if !grep ($_ eq '(io-channels) PASS', @output);
+fail "missing end in output\n" if !grep ($_ eq '(io-channels) end', @output);
+pass;
@@ -0,0 +1,50 @@
+/* Forks with a few pages of initialized data shared between
+   parent and child, then has the child write to them.  The
+   writes must fault a private copy into the child and leave the
+   parent's pages as they were. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (4 * 4096)
+
+static char buf[SIZE];
+
+/* Fails unless every byte of buf is VALUE. */
+static void check_buf(char value, const char* who) {
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != value)
+      fail("%s: byte %zu is %02hhx, not %02hhx", who, i, buf[i], value);
+}
+
+void test_main(void) {
+  pid_t pid;
+
+  msg("initialize");
+  memset(buf, 'p', sizeof buf);
+
+  msg("fork");
+  pid = fork();
+  if (pid == 0) {
+    check_buf('p', "child");
+    memset(buf, 'c', sizeof buf);
+    check_buf('c', "child");
+    msg("child: wrote its copy");
+    exit(82);
+  }
+  if (pid < 0)
+    fail("fork returned %d", pid);
+
+  if (wait(pid) != 82)
+    fail("wrong exit code from child");
+  check_buf('p', "parent");
+  msg("parent: data unchanged");
+
+  memset(buf, 'q', sizeof buf);
+  check_buf('q', "parent");
+  msg("parent: wrote its copy");
+}
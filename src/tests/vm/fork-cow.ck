@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-cow) begin
+(fork-cow) initialize
+(fork-cow) fork
+(fork-cow) child: wrote its copy
+(fork-cow) parent: data unchanged
+(fork-cow) parent: wrote its copy
+(fork-cow) end
+EOF
+pass;
@@ -0,0 +1,50 @@
+/* Reads part of a file, then forks.  The child's descriptor must
+   be open at the same position, and reading through it must not
+   move the parent's. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PART 64
+
+/* Reads the next PART bytes from HANDLE, which should be at
+   offset PART, and checks them against the sample. */
+static void read_part(int handle, const char* who) {
+  char part[PART];
+
+  if (tell(handle) != PART)
+    fail("%s: file position is %u, not %d", who, tell(handle), PART);
+  if (read(handle, part, PART) != PART)
+    fail("%s: short read", who);
+  if (memcmp(part, sample + PART, PART))
+    fail("%s: read wrong data", who);
+}
+
+void test_main(void) {
+  char part[PART];
+  int handle;
+  pid_t pid;
+
+  CHECK((handle = open("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK(read(handle, part, PART) == PART, "read \"sample.txt\"");
+
+  msg("fork");
+  pid = fork();
+  if (pid == 0) {
+    read_part(handle, "child");
+    close(handle);
+    msg("child: read from same position");
+    exit(84);
+  }
+  if (pid < 0)
+    fail("fork returned %d", pid);
+
+  if (wait(pid) != 84)
+    fail("wrong exit code from child");
+  read_part(handle, "parent");
+  msg("parent: read from same position");
+  close(handle);
+}
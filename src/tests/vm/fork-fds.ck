@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-fds) begin
+(fork-fds) open "sample.txt"
+(fork-fds) read "sample.txt"
+(fork-fds) fork
+(fork-fds) child: read from same position
+(fork-fds) parent: read from same position
+(fork-fds) end
+EOF
+pass;
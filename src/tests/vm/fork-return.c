@@ -0,0 +1,27 @@
+/* Forks a child and checks that fork returns 0 in the child and
+   the child's pid in the parent, and that the parent can wait
+   for the child's exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void test_main(void) {
+  pid_t pid;
+
+  msg("fork");
+  pid = fork();
+  if (pid == 0) {
+    msg("child: fork returned 0");
+    exit(81);
+  }
+  if (pid < 0)
+    fail("fork returned %d", pid);
+
+  /* Only report once the child is done, to keep the output in a
+     fixed order. */
+  if (wait(pid) != 81)
+    fail("wrong exit code from child");
+  msg("parent: fork returned child pid");
+  msg("wait for child");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-return) begin
+(fork-return) fork
+(fork-return) child: fork returned 0
+(fork-return) parent: fork returned child pid
+(fork-return) wait for child
+(fork-return) end
+EOF
+pass;
@@ -0,0 +1,50 @@
+/* Fills 2 MB of memory, enough that much of it goes to swap,
+   then forks.  The child decrypts its copy in place and checks
+   that it gets zeros back, which needs the pages the parent had
+   swapped out.  Then the parent does the same with its own copy,
+   which the child's writes must not have touched. */
+
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+
+static char buf[SIZE];
+
+/* Decrypts buf and fails unless it is all zeros. */
+static void decrypt_and_check(const char* who) {
+  struct arc4 arc4;
+  size_t i;
+
+  arc4_init(&arc4, "foobar", 6);
+  arc4_crypt(&arc4, buf, SIZE);
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != '\0')
+      fail("%s: byte %zu != 0", who, i);
+}
+
+void test_main(void) {
+  struct arc4 arc4;
+  pid_t pid;
+
+  msg("encrypt zeros");
+  arc4_init(&arc4, "foobar", 6);
+  arc4_crypt(&arc4, buf, SIZE);
+
+  msg("fork");
+  pid = fork();
+  if (pid == 0) {
+    decrypt_and_check("child");
+    msg("child: decrypted its copy");
+    exit(83);
+  }
+  if (pid < 0)
+    fail("fork returned %d", pid);
+
+  if (wait(pid) != 83)
+    fail("wrong exit code from child");
+  decrypt_and_check("parent");
+  msg("parent: decrypted its copy");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-swap) begin
+(fork-swap) encrypt zeros
+(fork-swap) fork
+(fork-swap) child: decrypted its copy
+(fork-swap) parent: decrypted its copy
+(fork-swap) end
+EOF
+pass;
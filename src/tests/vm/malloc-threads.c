@@ -0,0 +1,70 @@
+/* Moves the end of the heap with sbrk(), then has several
+   threads allocate, fill, check, and free blocks of many sizes
+   with malloc() at the same time. */
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 4
+#define BLOCK_CNT 64
+#define ROUND_CNT 20
+
+static void allocate_blocks(void* seed_) {
+  int seed = *(int*)seed_;
+  uint8_t** blocks = malloc(BLOCK_CNT * sizeof *blocks);
+  int round, i, j;
+
+  if (blocks == NULL)
+    fail("malloc failed");
+  for (round = 0; round < ROUND_CNT; round++) {
+    for (i = 0; i < BLOCK_CNT; i++) {
+      size_t size = 1 + (i * 37 + round * 11) % 1500;
+      blocks[i] = malloc(size);
+      if (blocks[i] == NULL)
+        fail("malloc of %zu bytes failed", size);
+      memset(blocks[i], seed + i, size);
+    }
+    for (i = 0; i < BLOCK_CNT; i++) {
+      size_t size = 1 + (i * 37 + round * 11) % 1500;
+      for (j = 0; j < (int)size; j++)
+        if (blocks[i][j] != (uint8_t)(seed + i))
+          fail("block %d corrupted at byte %d", i, j);
+      free(blocks[i]);
+    }
+  }
+  free(blocks);
+}
+
+void test_main(void) {
+  int seeds[THREAD_CNT + 1];
+  tid_t tids[THREAD_CNT];
+  uint8_t* brk = sbrk(0);
+  uint8_t* big;
+  int i;
+
+  CHECK(sbrk(8192) == brk, "grow heap by 2 pages");
+  memset(brk, 0x5a, 8192);
+  CHECK(sbrk(-8192) == brk + 8192, "shrink heap by 2 pages");
+  CHECK(sbrk(0) == brk, "heap is back where it started");
+
+  big = calloc(5, 4096);
+  CHECK(big != NULL, "calloc 20 kB");
+  for (i = 0; i < 5 * 4096; i++)
+    if (big[i] != 0)
+      fail("byte %d of calloc'd block is not zero", i);
+  free(big);
+
+  for (i = 0; i <= THREAD_CNT; i++)
+    seeds[i] = i * 64;
+  for (i = 0; i < THREAD_CNT; i++)
+    tids[i] = pthread_check_create(allocate_blocks, &seeds[i]);
+  allocate_blocks(&seeds[THREAD_CNT]);
+  for (i = 0; i < THREAD_CNT; i++)
+    pthread_check_join(tids[i]);
+  msg("all threads done");
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(malloc-threads) begin
+(malloc-threads) grow heap by 2 pages
+(malloc-threads) shrink heap by 2 pages
+(malloc-threads) heap is back where it started
+(malloc-threads) calloc 20 kB
+(malloc-threads) all threads done
+(malloc-threads) end
+EOF
+pass;
@@ -37,8 +37,16 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/journal.h"
+#endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/share.h"
+#include "vm/swap.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -55,6 +63,13 @@ static const char* scratch_bdev_name;
 #ifdef VM
 static const char* swap_bdev_name;
 #endif
+
+/* -ramdisk: Size of RAM disk in kB, 0 for none. */
+static size_t ramdisk_size;
+
+/* -iosched: I/O scheduler for every block device, or null to
+   keep the default. */
+static const struct block_scheduler* io_scheduler;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -72,6 +87,7 @@ static void usage(void);
 #ifdef FILESYS
 static void locate_block_devices(void);
 static void locate_block_device(enum block_type, const char* name);
+static void set_io_scheduler(void);
 #endif
 
 /* Pintos main program. */
@@ -130,10 +146,20 @@ int main(void) {
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init();
+  ramdisk_init(ramdisk_size);
+  set_io_scheduler();
   locate_block_devices();
   filesys_init(format_filesys);
 #endif
 
+#ifdef VM
+  /* Initialize virtual memory. */
+  frame_init();
+  swap_init();
+  share_init();
+  page_init();
+#endif
+
   printf("Boot complete.\n");
 
   /* Run actions specified on kernel command line. */
@@ -247,6 +273,18 @@ static char** parse_options(char** argv) {
       filesys_bdev_name = value;
     else if (!strcmp(name, "-scratch"))
       scratch_bdev_name = value;
+    else if (!strcmp(name, "-ramdisk"))
+      ramdisk_size = atoi(value);
+    else if (!strcmp(name, "-crash"))
+      journal_crash = true;
+    else if (!strcmp(name, "-iosched")) {
+      if (!strcmp(value, block_fifo_scheduler.name))
+        io_scheduler = &block_fifo_scheduler;
+      else if (!strcmp(value, block_clook_scheduler.name))
+        io_scheduler = &block_clook_scheduler;
+      else
+        PANIC("unknown I/O scheduler `%s' (use -h for help)", value);
+    }
 #ifdef VM
     else if (!strcmp(name, "-swap"))
       swap_bdev_name = value;
@@ -430,6 +468,9 @@ static void usage(void) {
 #ifdef VM
          "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif // VM
+         "  -ramdisk=SIZE      Create a SIZE kB RAM disk named ram0.\n"
+         "  -iosched=NAME      Use I/O scheduler NAME (fifo or c-look) for every disk.\n"
+         "  -crash             Power off without writing back the last journal commit.\n"
 #endif // FILESYS
          "  -rs=SEED           Set random number seed to SEED.\n"
          "  -sched-fair        Use alternate non-strict priority scheduler. Mutually exclusive "
@@ -455,10 +496,35 @@ static void locate_block_devices(void) {
 #endif
 }
 
+/* Applies the I/O scheduler chosen with -iosched, if any, to
+   every block device. */
+static void set_io_scheduler(void) {
+  struct block* block;
+
+  if (io_scheduler != NULL)
+    for (block = block_first(); block != NULL; block = block_next(block))
+      block_set_scheduler(block, io_scheduler);
+}
+
+/* Returns true if BLOCK is on the same bus as a block device
+   that already has a role. */
+static bool bus_in_use(struct block* block) {
+  int role;
+
+  for (role = 0; role < BLOCK_ROLE_CNT; role++) {
+    struct block* other = block_get_role(role);
+    if (other != NULL && block_bus(other) == block_bus(block))
+      return true;
+  }
+  return false;
+}
+
 /* Figures out what block device to use for the given ROLE: the
    block device with the given NAME, if NAME is non-null,
-   otherwise the first block device in probe order of type
-   ROLE. */
+   otherwise the first block device in probe order of type ROLE
+   that is on a bus no other role uses, so that I/O for different
+   roles can proceed in parallel, or failing that the first block
+   device in probe order of type ROLE. */
 static void locate_block_device(enum block_type role, const char* name) {
   struct block* block = NULL;
 
@@ -467,9 +533,17 @@ static void locate_block_device(enum block_type role, const char* name) {
     if (block == NULL)
       PANIC("No such block device \"%s\"", name);
   } else {
+    struct block* fallback = NULL;
+
     for (block = block_first(); block != NULL; block = block_next(block))
-      if (block_type(block) == role)
-        break;
+      if (block_type(block) == role) {
+        if (!bus_in_use(block))
+          break;
+        if (fallback == NULL)
+          fallback = block;
+      }
+    if (block == NULL)
+      block = fallback;
   }
 
   if (block != NULL) {
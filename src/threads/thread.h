@@ -7,6 +7,8 @@
 #include "threads/fixed-point.h"
 #include "threads/synch.h"
 
+struct intr_frame;
+
 /* States in a thread's life cycle. */
 enum thread_status {
   THREAD_RUNNING, /* Running thread. */
@@ -103,6 +105,17 @@ struct thread {
   struct join_status* join_status;
 #endif
 
+#ifdef FILESYS
+  /* Owned by filesys/journal.c. */
+  int journal_depth; /* Nesting depth of open journal operations. */
+#endif
+
+#ifdef VM
+  /* Owned by userprog/exception.c and userprog/syscall.c. */
+  void* user_esp;                /* User stack pointer on last entry to the kernel. */
+  struct intr_frame* syscall_if; /* User registers of the current system call. */
+#endif
+
   /* Additional user threads related meta data */
   bool exited;
   struct user_thread_entry* joiner;
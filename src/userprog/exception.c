@@ -5,6 +5,9 @@
 #include "userprog/process.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -57,7 +60,12 @@ void exception_init(void) {
 }
 
 /* Prints exception statistics. */
-void exception_print_stats(void) { printf("Exception: %lld page faults\n", page_fault_cnt); }
+void exception_print_stats(void) {
+  printf("Exception: %lld page faults\n", page_fault_cnt);
+#ifdef VM
+  page_print_stats();
+#endif
+}
 
 /* Handler for an exception (probably) caused by a user process. */
 static void kill(struct intr_frame* f) {
@@ -135,6 +143,21 @@ static void page_fault(struct intr_frame* f) {
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  /* Bring in a page that is not in memory yet, whether the
+     process itself or a system call on its behalf touched it.
+     A system call recorded the user stack pointer on entry. */
+  if (user)
+    thread_current()->user_esp = f->esp;
+  if (not_present && page_in(fault_addr))
+    return;
+
+  /* Copy a page that a forked process shares with its parent or
+     child on the first write to it. */
+  if (!not_present && write && page_unshare(fault_addr))
+    return;
+#endif
+
   /* Handle bad dereferences from system call implementations. */
   if (!user) {
     f->eip = (void (*)(void))f->eax;
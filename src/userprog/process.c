@@ -21,10 +21,17 @@
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
 static thread_func start_pthread NO_RETURN;
 static bool load(const char* cmd_line, void (**eip)(void), void** esp);
+#ifdef VM
+static bool fork_process(struct thread* parent, const struct intr_frame* parent_if,
+                         struct intr_frame* if_);
+#endif
 bool setup_thread(void (**eip)(void), void** esp, void* aux);
 
 /* Data structure shared between process_execute() in the
@@ -35,6 +42,10 @@ struct exec_info {
   struct semaphore load_done;      /* "Up"ed when loading complete. */
   struct wait_status* wait_status; /* Child process. */
   bool success;                    /* Program successfully loaded? */
+#ifdef VM
+  struct thread* parent;              /* Thread to copy for fork, or null. */
+  const struct intr_frame* parent_if; /* PARENT's user registers. */
+#endif
 };
 
 /* Initializes user programs in the system by ensuring the main
@@ -61,6 +72,25 @@ void userprog_init(void) {
   ASSERT(success);
 }
 
+/* Creates a thread named NAME to start the child process that
+   EXEC describes, and waits for it to load.  Returns the child's
+   process id, or TID_ERROR if it cannot be started. */
+static pid_t start_child(const char* name, struct exec_info* exec) {
+  tid_t tid;
+
+  sema_init(&exec->load_done, 0);
+  tid = thread_create(name, PRI_DEFAULT, start_process, exec);
+  if (tid != TID_ERROR) {
+    sema_down(&exec->load_done);
+    if (exec->success)
+      list_push_back((struct list*)&thread_current()->pcb->children, &exec->wait_status->elem);
+    else
+      tid = TID_ERROR;
+  }
+
+  return tid;
+}
+
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
    before process_execute() returns.  Returns the new process's
@@ -69,26 +99,37 @@ pid_t process_execute(const char* file_name) {
   struct exec_info exec;
   char thread_name[16];
   char* save_ptr;
-  tid_t tid;
 
   /* Initialize exec_info. */
   exec.file_name = file_name;
-  sema_init(&exec.load_done, 0);
+#ifdef VM
+  exec.parent = NULL;
+#endif
 
   /* Create a new thread to execute FILE_NAME. */
   strlcpy(thread_name, file_name, sizeof thread_name);
   strtok_r(thread_name, " ", &save_ptr);
-  tid = thread_create(thread_name, PRI_DEFAULT, start_process, &exec);
-  if (tid != TID_ERROR) {
-    sema_down(&exec.load_done);
-    if (exec.success)
-      list_push_back((struct list*)&thread_current()->pcb->children, &exec.wait_status->elem);
-    else
-      tid = TID_ERROR;
-  }
+  return start_child(thread_name, &exec);
+}
 
-  return tid;
+#ifdef VM
+/* Starts a new process that is a copy of the current one, as the
+   fork system call whose registers are in F left it, except that
+   fork returns 0 in the copy.  Only the calling thread is copied.
+   Open files are reopened at the same positions; memory-mapped
+   files are not inherited.  The new process may be scheduled
+   (and may even exit) before process_fork() returns.  Returns
+   the new process's process id, or TID_ERROR if it cannot be
+   created. */
+pid_t process_fork(const struct intr_frame* f) {
+  struct exec_info exec;
+
+  exec.file_name = NULL;
+  exec.parent = thread_current();
+  exec.parent_if = f;
+  return start_child(thread_current()->pcb->process_name, &exec);
 }
+#endif
 
 /* A thread function that loads a user process and starts it
    running. */
@@ -99,6 +140,9 @@ static void start_process(void* exec_) {
   struct intr_frame if_;
   uint32_t fpu_curr[27];
   bool success, pcb_success, ws_success;
+#ifdef VM
+  bool pt_success = false;
+#endif
   user_thread_entry_t* user_thread_entry;
 
   /* Allocate process control block */
@@ -116,6 +160,12 @@ static void start_process(void* exec_) {
     list_init(&t->pcb->children);
     list_init(&t->pcb->fds);
     t->pcb->next_handle = 2;
+    lock_init(&t->pcb->fds_lock);
+#ifdef VM
+    list_init(&t->pcb->mappings);
+    t->pcb->heap_start = t->pcb->brk = NULL;
+    success = pt_success = page_table_init(t->pcb);
+#endif
     t->pcb->main_thread = t;
     strlcpy(t->pcb->process_name, t->name, sizeof t->name);
 
@@ -187,7 +237,12 @@ static void start_process(void* exec_) {
     if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
     if_.cs = SEL_UCSEG;
     if_.eflags = FLAG_IF | FLAG_MBS;
-    success = load(exec->file_name, &if_.eip, &if_.esp);
+#ifdef VM
+    if (exec->parent != NULL)
+      success = fork_process(exec->parent, exec->parent_if, &if_);
+    else
+#endif
+      success = load(exec->file_name, &if_.eip, &if_.esp);
   }
 
   /* Handle failure with succesful PCB malloc. Must free the PCB */
@@ -196,6 +251,12 @@ static void start_process(void* exec_) {
     // If this happens, then an unfortuantely timed timer interrupt
     // can try to activate the pagedir, but it is now freed memory
     struct process* pcb_to_free = t->pcb;
+#ifdef VM
+    /* Give back the frames and swap slots of whatever part of
+       the executable was loaded. */
+    if (pt_success)
+      page_table_destroy();
+#endif
     t->pcb = NULL;
     free(pcb_to_free);
   }
@@ -220,6 +281,89 @@ static void start_process(void* exec_) {
   NOT_REACHED();
 }
 
+#ifdef VM
+/* Makes the current process, newly created by process_fork(), a
+   copy of PARENT's process and sets IF_ to resume in user mode
+   where PARENT_IF left PARENT, with fork returning 0.  Returns
+   true if successful, false otherwise. */
+static bool fork_process(struct thread* parent, const struct intr_frame* parent_if,
+                         struct intr_frame* if_) {
+  struct thread* t = thread_current();
+  struct process* pcb = t->pcb;
+  struct process* ppcb = parent->pcb;
+  struct list_elem* e;
+  int i;
+
+  /* Allocate and activate page directory. */
+  pcb->pagedir = pagedir_create();
+  if (pcb->pagedir == NULL)
+    return false;
+  process_activate();
+
+  /* Copy the address space, whose executable pages refer to our
+     own copy of the executable. */
+  pcb->bin_file = file_reopen(ppcb->bin_file);
+  if (pcb->bin_file == NULL)
+    return false;
+  file_deny_write(pcb->bin_file);
+  if (!page_table_copy(ppcb)) {
+    file_close(pcb->bin_file);
+    return false;
+  }
+
+  /* Reopen the parent's files, each at the same position. */
+  lock_acquire(&ppcb->fds_lock);
+  for (e = list_begin(&ppcb->fds); e != list_end(&ppcb->fds); e = list_next(e)) {
+    struct file_descriptor* pfd = list_entry(e, struct file_descriptor, elem);
+    struct file_descriptor* fd = malloc(sizeof *fd);
+    if (fd == NULL || (fd->file = file_reopen(pfd->file)) == NULL) {
+      free(fd);
+      break;
+    }
+    file_seek(fd->file, file_tell(pfd->file));
+    fd->handle = pfd->handle;
+    fd->ref_cnt = 1;
+    list_push_back(&pcb->fds, &fd->elem);
+  }
+  pcb->next_handle = ppcb->next_handle;
+  pcb->heap_start = ppcb->heap_start;
+  pcb->brk = ppcb->brk;
+  lock_release(&ppcb->fds_lock);
+  if (e != list_end(&ppcb->fds)) {
+    while (!list_empty(&pcb->fds)) {
+      struct file_descriptor* fd =
+          list_entry(list_pop_front(&pcb->fds), struct file_descriptor, elem);
+      file_close(fd->file);
+      free(fd);
+    }
+    file_close(pcb->bin_file);
+    return false;
+  }
+
+  /* Copy user locks, all released, and semaphores. */
+  lock_acquire(&ppcb->process_thread_lock);
+  for (i = 0; i < 256; i++) {
+    pcb->locks[i].initialized = ppcb->locks[i].initialized;
+    pcb->locks[i].tid = 0;
+    if (pcb->locks[i].initialized)
+      lock_init(&pcb->locks[i].lock);
+    pcb->semaphores[i].initialized = ppcb->semaphores[i].initialized;
+    if (pcb->semaphores[i].initialized)
+      sema_init(&pcb->semaphores[i].sema, ppcb->semaphores[i].sema.value);
+  }
+
+  /* The parent's thread stacks were copied, so their offsets stay
+     in use.  Our only thread runs on the copy of the caller's. */
+  memcpy(pcb->offsets, ppcb->offsets, sizeof pcb->offsets);
+  lock_release(&ppcb->process_thread_lock);
+  t->upage = parent->upage;
+
+  *if_ = *parent_if;
+  if_->eax = 0;
+  return true;
+}
+#endif
+
 /* Releases one reference to CS and, if it is now unreferenced,
    frees it. */
 static void release_child(struct wait_status* cs) {
@@ -280,9 +424,6 @@ void process_exit(void) {
     NOT_REACHED();
   }
 
-  /* Close executable (and allow writes). */
-  safe_file_close(cur->pcb->bin_file);
-
   /* Free entries of children list. */
   for (e = list_begin(&cur->pcb->children); e != list_end(&cur->pcb->children); e = next) {
     struct wait_status* cs = list_entry(e, struct wait_status, elem);
@@ -313,6 +454,20 @@ void process_exit(void) {
     sys_close(fd->handle);
   }
 
+#ifdef VM
+  /* Write back and remove all memory mappings, then free the
+     supplemental page table. */
+  while (!list_empty(&cur->pcb->mappings)) {
+    e = list_begin(&cur->pcb->mappings);
+    sys_munmap(list_entry(e, struct mapping, elem)->handle);
+  }
+  page_table_destroy();
+#endif
+
+  /* Close executable (and allow writes), now that no pages are
+     read from it or shared through it. */
+  file_close(cur->pcb->bin_file);
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pcb->pagedir;
@@ -517,6 +672,11 @@ bool load(const char* cmd_line, void (**eip)(void), void** esp) {
           }
           if (!load_segment(file, file_page, (void*)mem_page, read_bytes, zero_bytes, writable))
             goto done;
+#ifdef VM
+          /* The heap begins above the highest segment. */
+          if ((uint8_t*)mem_page + read_bytes + zero_bytes > t->pcb->heap_start)
+            t->pcb->heap_start = t->pcb->brk = (uint8_t*)mem_page + read_bytes + zero_bytes;
+#endif
         } else
           goto done;
         break;
@@ -539,7 +699,9 @@ done:
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page(void* upage, void* kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -596,6 +758,10 @@ static bool validate_segment(const struct Elf32_Phdr* phdr, struct file* file) {
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With virtual memory, the pages are only recorded in the
+   supplemental page table here, and each one is read in when the
+   process first touches it.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool load_segment(struct file* file, off_t ofs, uint8_t* upage, uint32_t read_bytes,
@@ -604,6 +770,28 @@ static bool load_segment(struct file* file, off_t ofs, uint8_t* upage, uint32_t
   ASSERT(pg_ofs(upage) == 0);
   ASSERT(ofs % PGSIZE == 0);
 
+#ifdef VM
+  while (read_bytes > 0 || zero_bytes > 0) {
+    size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+    size_t page_zero_bytes = PGSIZE - page_read_bytes;
+    struct page* p;
+
+    p = page_allocate(upage, writable, page_read_bytes > 0 ? file : NULL, ofs, page_read_bytes);
+    if (p == NULL)
+      return false;
+
+    /* Changes to the segment belong to the process, not the
+       executable. */
+    p->private = true;
+
+    /* Advance. */
+    read_bytes -= page_read_bytes;
+    zero_bytes -= page_zero_bytes;
+    ofs += page_read_bytes;
+    upage += PGSIZE;
+  }
+  return true;
+#else
   file_seek(file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) {
     /* Calculate how to fill this page.
@@ -636,6 +824,7 @@ static bool load_segment(struct file* file, off_t ofs, uint8_t* upage, uint32_t
     upage += PGSIZE;
   }
   return true;
+#endif
 }
 
 /* Reverse the order of the ARGC pointers to char in ARGV. */
@@ -726,6 +915,17 @@ static bool setup_stack(const char* cmd_line, void** esp) {
   uint8_t* kpage;
   bool success = false;
 
+#ifdef VM
+  uint8_t* upage = ((uint8_t*)PHYS_BASE) - PGSIZE;
+  if (page_allocate(upage, true, NULL, 0, 0) != NULL) {
+    thread_current()->upage = upage;
+    kpage = page_pin(upage, true);
+    if (kpage != NULL) {
+      success = init_cmd_line(kpage, upage, cmd_line, esp);
+      page_unpin(upage);
+    }
+  }
+#else
   kpage = palloc_get_page(PAL_USER | PAL_ZERO);
   if (kpage != NULL) {
     uint8_t* upage = ((uint8_t*)PHYS_BASE) - PGSIZE;
@@ -736,10 +936,12 @@ static bool setup_stack(const char* cmd_line, void** esp) {
     } else
       palloc_free_page(kpage);
   }
+#endif
 
   return success;
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -757,6 +959,7 @@ static bool install_page(void* upage, void* kpage, bool writable) {
   return (pagedir_get_page(t->pcb->pagedir, upage) == NULL &&
           pagedir_set_page(t->pcb->pagedir, upage, kpage, writable));
 }
+#endif
 
 /* Returns true if t is the main thread of the process p */
 bool is_main_thread(struct thread* t, struct process* p) { return p->main_thread == t; }
@@ -764,6 +967,13 @@ bool is_main_thread(struct thread* t, struct process* p) { return p->main_thread
 /* Gets the PID of a process */
 pid_t get_pid(struct process* p) { return (pid_t)p->main_thread->tid; }
 
+/* Returns the user page for the stack of the thread that uses
+   OFFSET.  Thread stacks lie below the MAX_STACK_PAGES reserved
+   for the main thread's stack to grow into. */
+static uint8_t* thread_stack_page(int offset) {
+  return (uint8_t*)PHYS_BASE - (MAX_STACK_PAGES + offset) * PGSIZE;
+}
+
 /* Creates a new stack for the thread and sets up its arguments.
    Stores the thread's entry point into *EIP and its initial stack
    pointer into *ESP. Handles all cleanup if unsuccessful. Returns
@@ -784,11 +994,32 @@ bool setup_thread(void (**eip)(void), void** esp, void* aux) {
   *eip = (void*)args->sfun;
 
   /* Setup the stack and eip */
+#ifdef VM
+  int offset = get_lowest_offset(args->pcb);
+  upage = thread_stack_page(offset);
+  args->upage = upage;
+  args->offset = offset;
+
+  if (page_allocate(upage, true, NULL, 0, 0) == NULL)
+    return false;
+  kpage = page_pin(upage, true);
+  if (kpage != NULL) {
+    /* Push function and args onto the stack */
+    success = (push(kpage, &ofs, &args->arg, sizeof args->arg) != NULL &&
+               push(kpage, &ofs, &args->tfun, sizeof args->tfun) != NULL &&
+               push(kpage, &ofs, &null, sizeof null) != NULL);
+
+    /* set the stack pointer */
+    *esp = upage + ofs;
+    page_unpin(upage);
+  }
+  return success;
+#else
   kpage = palloc_get_page(PAL_USER | PAL_ZERO);
 
   if (kpage != NULL) {
     int offset = get_lowest_offset(args->pcb);
-    upage = ((uint8_t*)PHYS_BASE) - offset * PGSIZE;
+    upage = thread_stack_page(offset);
 
     /* store pages for destroying later, will get pushed to thread list */
     args->kpage = kpage;
@@ -797,9 +1028,6 @@ bool setup_thread(void (**eip)(void), void** esp, void* aux) {
 
     success = install_page(upage, kpage, true);
     if (success) {
-      // ofs = PHYS_BASE - (offset - 1) * PGSIZE;
-      *esp = PHYS_BASE - (offset - 1) * PGSIZE;
-
       /* Push function and args onto the stack */
       if (push(kpage, &ofs, &args->arg, sizeof args->arg) == NULL ||
           push(kpage, &ofs, &args->tfun, sizeof args->tfun) == NULL ||
@@ -813,6 +1041,7 @@ bool setup_thread(void (**eip)(void), void** esp, void* aux) {
       palloc_free_page(kpage);
   }
   return success;
+#endif
 }
 
 int get_lowest_offset(struct process* pcb) {
@@ -1003,8 +1232,12 @@ void pthread_exit(void) {
   list_remove(&thread_entry->elem);
   free(thread_entry);
   
+#ifdef VM
+  page_deallocate(t->upage);
+#else
   pagedir_clear_page(t->pcb->pagedir, t->upage);
   palloc_free_page(t->kpage);
+#endif
 
   /* Synch here for bitmap flip */
   lock_acquire(process_thread_lock);
@@ -1085,8 +1318,12 @@ void pthread_exit_main(void) {
   }*/
 
   /* finally free the kpage and exit the process */
+#ifdef VM
+  page_deallocate(t->upage);
+#else
   pagedir_clear_page(t->pcb->pagedir, t->upage);
   palloc_free_page(t->kpage);
+#endif
 
   process_exit();
 }
@@ -2,10 +2,13 @@
 #define USERPROG_PROCESS_H
 
 #include "threads/thread.h"
+#include <hash.h>
 #include <list.h>
 #include <stdint.h>
 #include "threads/synch.h"
 
+struct intr_frame;
+
 // At most 8MB can be allocated to the stack
 // These defines will be used in Project 2: Multithreading
 #define MAX_STACK_PAGES (1 << 11)
@@ -83,8 +86,18 @@ struct process {
   struct thread* main_thread; /* Pointer to main thread */
 
   /* Owned by syscall.c. */
-  struct list fds; /* List of file descriptors. */
-  int next_handle; /* Next handle value. */
+  struct list fds;         /* List of file descriptors. */
+  int next_handle;         /* Next handle value. */
+  struct lock fds_lock;    /* Protects fds, next_handle and mappings. */
+#ifdef VM
+  struct list mappings; /* Memory-mapped files. */
+
+  /* Owned by vm/page.c. */
+  struct hash pages;      /* Supplemental page table. */
+  struct lock pages_lock; /* Protects pages; brk also needs fds_lock. */
+  uint8_t* heap_start;    /* Start of the heap, just past the executable. */
+  uint8_t* brk;           /* End of the heap (the program break). */
+#endif
 
   /* Global lock for user threads */
   struct lock process_thread_lock;
@@ -125,11 +138,24 @@ struct file_descriptor {
   struct list_elem elem; /* List element. */
   struct file* file;     /* File. */
   int handle;            /* File handle. */
+  int ref_cnt;           /* References, including the fds list's. */
+};
+
+/* A memory-mapped file. */
+struct mapping {
+  struct list_elem elem; /* List element. */
+  int handle;            /* Mapping id. */
+  struct file* file;     /* File, reopened for the mapping. */
+  uint8_t* base;         /* Start of memory mapping. */
+  size_t page_cnt;       /* Number of pages mapped. */
 };
 
 void userprog_init(void);
 
 pid_t process_execute(const char* file_name);
+#ifdef VM
+pid_t process_fork(const struct intr_frame*);
+#endif
 int process_wait(pid_t);
 void process_exit(void);
 void process_activate(void);
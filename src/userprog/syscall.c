@@ -1,8 +1,10 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
 #include <float.h>
+#include <round.h>
 #include <string.h>
 #include <syscall-nr.h>
+#include "devices/block.h"
 #include "devices/input.h"
 #include "devices/shutdown.h"
 #include "filesys/filesys.h"
@@ -14,27 +16,37 @@
 #include "threads/vaddr.h"
 #include "userprog/process.h"
 #include "userprog/pagedir.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 static void syscall_handler(struct intr_frame*);
 static void copy_in(void*, const void*, size_t);
 
-bool retval;
+/* Most bytes of a user buffer that read and write pin at once.
+   Larger buffers are transferred in pieces, each ending on a
+   multiple of this size, so that one call never holds more than
+   XFER_PAGES frames no matter how much the process asks for. */
+#define XFER_PAGES 16
+#define XFER_SIZE (XFER_PAGES * PGSIZE)
 
-/* Serializes file system operations. */
-static struct lock fs_lock;
+bool retval;
 
 /* Pointer to current thread global lock */
 struct lock* process_thread_lock;
 
 void syscall_init(void) {
   intr_register_int(0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init(&fs_lock);
 }
 
 /* System call handler. */
 static void syscall_handler(struct intr_frame* f) {
   typedef int syscall_function(int, int, int);
   process_thread_lock = &thread_current()->pcb->process_thread_lock;
+#ifdef VM
+  thread_current()->user_esp = f->esp;
+  thread_current()->syscall_if = f;
+#endif
 
   /* A system call. */
   struct syscall {
@@ -69,6 +81,29 @@ static void syscall_handler(struct intr_frame* f) {
       {1, (syscall_function*)sys_sema_down},    /* Downs a semaphore */
       {1, (syscall_function*)sys_sema_up},      /* Ups a semaphore */
       {0, (syscall_function*)sys_get_tid},      /* Gets TID of the current thread */
+#ifdef VM
+      {2, (syscall_function*)sys_mmap},         /* Maps a file into memory */
+      {1, (syscall_function*)sys_munmap},       /* Removes a memory mapping */
+#else
+      {2, NULL},                                /* mmap, not implemented */
+      {1, NULL},                                /* munmap, not implemented */
+#endif
+      {1, NULL},                                /* chdir, not implemented */
+      {1, NULL},                                /* mkdir, not implemented */
+      {2, NULL},                                /* readdir, not implemented */
+      {1, NULL},                                /* isdir, not implemented */
+      {1, NULL},                                /* inumber, not implemented */
+      {0, (syscall_function*)sys_iostat},       /* Prints block device statistics */
+#ifdef VM
+      {0, (syscall_function*)sys_fork},         /* Clones the current process */
+#else
+      {0, NULL},                                /* fork, not implemented */
+#endif
+#ifdef VM
+      {1, (syscall_function*)sys_sbrk},         /* Moves the end of the heap */
+#else
+      {1, NULL},                                /* sbrk, not implemented */
+#endif
   };
 
   const struct syscall* sc;
@@ -94,17 +129,51 @@ static void syscall_handler(struct intr_frame* f) {
   f->eax = sc->func(args[0], args[1], args[2]);
 }
 
-/* Closes a file safely */
-void safe_file_close(struct file* file) {
-  lock_acquire(&fs_lock);
-  file_close(file);
-  lock_release(&fs_lock);
+/* Returns true if UADDR is a valid, mapped user address,
+   false otherwise.  With virtual memory, also requires the page
+   to be writable if WRITE is true, and brings it into memory and
+   pins it there, so that the kernel can access it without
+   faulting until unpin_user_range() releases it. */
+static bool verify_user(const void* uaddr, bool write UNUSED) {
+  if (uaddr >= PHYS_BASE)
+    return false;
+#ifdef VM
+  return page_pin(uaddr, write) != NULL;
+#else
+  return pagedir_get_page(thread_current()->pcb->pagedir, uaddr) != NULL;
+#endif
 }
 
-/* Returns true if UADDR is a valid, mapped user address,
-   false otherwise. */
-static bool verify_user(const void* uaddr) {
-  return (uaddr < PHYS_BASE && pagedir_get_page(thread_current()->pcb->pagedir, uaddr) != NULL);
+/* Unpins the pages of the SIZE bytes starting at user address
+   UADDR, pinned by verify_user_range(). */
+static void unpin_user_range(const void* uaddr UNUSED, size_t size UNUSED) {
+#ifdef VM
+  const uint8_t* start = uaddr;
+  const uint8_t* page;
+
+  for (page = pg_round_down(start); page < start + size; page += PGSIZE)
+    page_unpin(page);
+#endif
+}
+
+/* Returns true if every byte of the SIZE bytes starting at user
+   address UADDR is valid and mapped, and writable if WRITE is
+   true, false otherwise.  If successful, the caller must pass
+   the same range to unpin_user_range() when done with it. */
+static bool verify_user_range(const void* uaddr, size_t size, bool write) {
+  const uint8_t* start = uaddr;
+  const uint8_t* end = start + size;
+  const uint8_t* first = pg_round_down(start);
+  const uint8_t* page;
+
+  if (end < start || end > (const uint8_t*)PHYS_BASE)
+    return false;
+  for (page = first; page < end; page += PGSIZE)
+    if (!verify_user(page, write)) {
+      unpin_user_range(first, page - first);
+      return false;
+    }
+  return true;
 }
 
 /* Copies a byte from user address USRC to kernel address DST.
@@ -185,9 +254,7 @@ int sys_exec(const char* ufile) {
   pid_t tid;
   char* kfile = copy_in_string(ufile);
 
-  lock_acquire(&fs_lock);
   tid = process_execute(kfile);
-  lock_release(&fs_lock);
 
   palloc_free_page(kfile);
 
@@ -202,9 +269,7 @@ int sys_create(const char* ufile, unsigned initial_size) {
   char* kfile = copy_in_string(ufile);
   bool ok;
 
-  lock_acquire(&fs_lock);
   ok = filesys_create(kfile, initial_size);
-  lock_release(&fs_lock);
 
   palloc_free_page(kfile);
 
@@ -216,9 +281,7 @@ int sys_remove(const char* ufile) {
   char* kfile = copy_in_string(ufile);
   bool ok;
 
-  lock_acquire(&fs_lock);
   ok = filesys_remove(kfile);
-  lock_release(&fs_lock);
 
   palloc_free_page(kfile);
 
@@ -233,51 +296,107 @@ int sys_open(const char* ufile) {
 
   fd = malloc(sizeof *fd);
   if (fd != NULL) {
-    lock_acquire(&fs_lock);
     fd->file = filesys_open(kfile);
     if (fd->file != NULL) {
-      struct thread* cur = thread_current();
-      handle = fd->handle = cur->pcb->next_handle++;
-      list_push_front(&cur->pcb->fds, &fd->elem);
+      struct process* pcb = thread_current()->pcb;
+      lock_acquire(&pcb->fds_lock);
+      handle = fd->handle = pcb->next_handle++;
+      fd->ref_cnt = 1;
+      list_push_front(&pcb->fds, &fd->elem);
+      lock_release(&pcb->fds_lock);
     } else
       free(fd);
-    lock_release(&fs_lock);
   }
 
   palloc_free_page(kfile);
   return handle;
 }
 
-/* Returns the file descriptor associated with the given handle.
+/* Returns the file descriptor associated with the given handle,
+   with a reference that the caller must drop with put_fd().
    Terminates the process if HANDLE is not associated with an
    open file. */
 static struct file_descriptor* lookup_fd(int handle) {
-  struct thread* cur = thread_current();
+  struct process* pcb = thread_current()->pcb;
+  struct list_elem* e;
+
+  lock_acquire(&pcb->fds_lock);
+  for (e = list_begin(&pcb->fds); e != list_end(&pcb->fds); e = list_next(e)) {
+    struct file_descriptor* fd;
+    fd = list_entry(e, struct file_descriptor, elem);
+    if (fd->handle == handle) {
+      fd->ref_cnt++;
+      lock_release(&pcb->fds_lock);
+      return fd;
+    }
+  }
+  lock_release(&pcb->fds_lock);
+
+  pthread_exit_main();
+  NOT_REACHED();
+}
+
+/* Removes the file descriptor associated with the given handle
+   from the process's list and returns it, still holding the
+   list's reference.  Finding and unlinking happen under one
+   acquisition of fds_lock, so only one close of a handle can
+   succeed.  Terminates the process if HANDLE is not associated
+   with an open file. */
+static struct file_descriptor* remove_fd(int handle) {
+  struct process* pcb = thread_current()->pcb;
   struct list_elem* e;
 
-  for (e = list_begin(&cur->pcb->fds); e != list_end(&cur->pcb->fds); e = list_next(e)) {
+  lock_acquire(&pcb->fds_lock);
+  for (e = list_begin(&pcb->fds); e != list_end(&pcb->fds); e = list_next(e)) {
     struct file_descriptor* fd;
     fd = list_entry(e, struct file_descriptor, elem);
-    if (fd->handle == handle)
+    if (fd->handle == handle) {
+      list_remove(&fd->elem);
+      lock_release(&pcb->fds_lock);
       return fd;
+    }
   }
+  lock_release(&pcb->fds_lock);
 
   pthread_exit_main();
   NOT_REACHED();
 }
 
+/* Drops a reference to FD.  The last reference, which outlives
+   a close that races with a read or write in another thread,
+   closes the file and frees FD. */
+static void put_fd(struct file_descriptor* fd) {
+  struct process* pcb = thread_current()->pcb;
+  bool last;
+
+  lock_acquire(&pcb->fds_lock);
+  last = --fd->ref_cnt == 0;
+  lock_release(&pcb->fds_lock);
+  if (last) {
+    file_close(fd->file);
+    free(fd);
+  }
+}
+
 /* Filesize system call. */
 int sys_filesize(int handle) {
   struct file_descriptor* fd = lookup_fd(handle);
   int size;
 
-  lock_acquire(&fs_lock);
   size = file_length(fd->file);
-  lock_release(&fs_lock);
+  put_fd(fd);
 
   return size;
 }
 
+/* Returns the number of bytes of the SIZE bytes at user address
+   UADDR that read and write transfer in one piece: up to the next
+   multiple of XFER_SIZE, or SIZE if that is less. */
+static size_t xfer_chunk(const uint8_t* uaddr, size_t size) {
+  size_t left = XFER_SIZE - (uintptr_t)uaddr % XFER_SIZE;
+  return size < left ? size : left;
+}
+
 /* Read system call. */
 int sys_read(int handle, void* udst_, unsigned size) {
   uint8_t* udst = udst_;
@@ -292,39 +411,32 @@ int sys_read(int handle, void* udst_, unsigned size) {
     return bytes_read;
   }
 
-  /* Handle all other reads. */
+  /* Handle all other reads.  Each piece of the buffer is pinned
+     while the file system transfers straight into it, then
+     released before the next. */
   fd = lookup_fd(handle);
-  lock_acquire(&fs_lock);
   while (size > 0) {
-    /* How much to read into this page? */
-    size_t page_left = PGSIZE - pg_ofs(udst);
-    size_t read_amt = size < page_left ? size : page_left;
+    size_t chunk = xfer_chunk(udst, size);
     off_t retval;
 
-    /* Check that touching this page is okay. */
-    if (!verify_user(udst)) {
-      lock_release(&fs_lock);
+    if (!verify_user_range(udst, chunk, true)) {
+      put_fd(fd);
       pthread_exit_main();
     }
-
-    /* Read from file into page. */
-    retval = file_read(fd->file, udst, read_amt);
+    retval = file_read(fd->file, udst, chunk);
+    unpin_user_range(udst, chunk);
     if (retval < 0) {
       if (bytes_read == 0)
         bytes_read = -1;
       break;
     }
     bytes_read += retval;
-
-    /* If it was a short read we're done. */
-    if (retval != (off_t)read_amt)
+    if (retval != (off_t)chunk)
       break;
-
-    /* Advance. */
-    udst += retval;
-    size -= retval;
+    udst += chunk;
+    size -= chunk;
   }
-  lock_release(&fs_lock);
+  put_fd(fd);
 
   return bytes_read;
 }
@@ -339,41 +451,35 @@ int sys_write(int handle, void* usrc_, unsigned size) {
   if (handle != STDOUT_FILENO)
     fd = lookup_fd(handle);
 
-  lock_acquire(&fs_lock);
+  /* Pin each piece of the buffer in turn and write it out. */
   while (size > 0) {
-    /* How much bytes to write to this page? */
-    size_t page_left = PGSIZE - pg_ofs(usrc);
-    size_t write_amt = size < page_left ? size : page_left;
+    size_t chunk = xfer_chunk(usrc, size);
     off_t retval;
 
-    /* Check that we can touch this user page. */
-    if (!verify_user(usrc)) {
-      lock_release(&fs_lock);
+    if (!verify_user_range(usrc, chunk, false)) {
+      if (fd != NULL)
+        put_fd(fd);
       pthread_exit_main();
     }
-
-    /* Do the write. */
     if (handle == STDOUT_FILENO) {
-      putbuf(usrc, write_amt);
-      retval = write_amt;
+      putbuf(usrc, chunk);
+      retval = chunk;
     } else
-      retval = file_write(fd->file, usrc, write_amt);
+      retval = file_write(fd->file, usrc, chunk);
+    unpin_user_range(usrc, chunk);
     if (retval < 0) {
       if (bytes_written == 0)
         bytes_written = -1;
       break;
     }
     bytes_written += retval;
-
-    /* If it was a short write we're done. */
-    if (retval != (off_t)write_amt)
+    if (retval != (off_t)chunk)
       break;
-
-    /* Advance. */
-    usrc += retval;
-    size -= retval;
+    usrc += chunk;
+    size -= chunk;
   }
-  lock_release(&fs_lock);
+  if (fd != NULL)
+    put_fd(fd);
 
   return bytes_written;
 }
@@ -382,10 +488,9 @@ int sys_write(int handle, void* usrc_, unsigned size) {
 int sys_seek(int handle, unsigned position) {
   struct file_descriptor* fd = lookup_fd(handle);
 
-  lock_acquire(&fs_lock);
   if ((off_t)position >= 0)
     file_seek(fd->file, position);
-  lock_release(&fs_lock);
+  put_fd(fd);
 
   return 0;
 }
@@ -395,19 +500,15 @@ int sys_tell(int handle) {
   struct file_descriptor* fd = lookup_fd(handle);
   unsigned position;
 
-  lock_acquire(&fs_lock);
   position = file_tell(fd->file);
-  lock_release(&fs_lock);
+  put_fd(fd);
 
   return position;
 }
 
 /* Close system call. */
 int sys_close(int handle) {
-  struct file_descriptor* fd = lookup_fd(handle);
-  safe_file_close(fd->file);
-  list_remove(&fd->elem);
-  free(fd);
+  put_fd(remove_fd(handle));
   return 0;
 }
 
@@ -573,3 +674,150 @@ bool sys_sema_up(sema_t* sema) {
 }
 
 tid_t sys_get_tid(void) { return thread_current()->tid; }
+
+/* Iostat system call. */
+int sys_iostat(void) {
+  block_print_io_stats();
+  return 0;
+}
+
+#ifdef VM
+/* Mmap system call. */
+int sys_mmap(int handle, void* addr) {
+  struct file_descriptor* fd = lookup_fd(handle);
+  struct process* pcb = thread_current()->pcb;
+  struct file* file;
+  struct mapping* m;
+  off_t length;
+  size_t i;
+
+  file = file_reopen(fd->file);
+  put_fd(fd);
+  if (file == NULL || addr == NULL || pg_ofs(addr) != 0) {
+    file_close(file);
+    return -1;
+  }
+
+  m = malloc(sizeof *m);
+  if (m == NULL) {
+    file_close(file);
+    return -1;
+  }
+  m->file = file;
+  length = file_length(m->file);
+  m->base = addr;
+  m->page_cnt = DIV_ROUND_UP(length, PGSIZE);
+  if (length == 0 || m->page_cnt > (size_t)((uint8_t*)PHYS_BASE - m->base) / PGSIZE) {
+    file_close(m->file);
+    free(m);
+    return -1;
+  }
+
+  /* Record each page, to be read in when first touched.  Fails
+     if any page overlaps part of the address space in use.  Holds
+     the descriptor lock throughout so that sbrk cannot grow the
+     heap into the pages before they are listed as a mapping. */
+  lock_acquire(&pcb->fds_lock);
+  for (i = 0; i < m->page_cnt; i++) {
+    off_t ofs = i * PGSIZE;
+    size_t bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+    if (page_allocate(m->base + ofs, true, m->file, ofs, bytes) == NULL) {
+      while (i-- > 0)
+        page_deallocate(m->base + i * PGSIZE);
+      lock_release(&pcb->fds_lock);
+      file_close(m->file);
+      free(m);
+      return -1;
+    }
+  }
+  m->handle = pcb->next_handle++;
+  list_push_front(&pcb->mappings, &m->elem);
+  lock_release(&pcb->fds_lock);
+  return m->handle;
+}
+
+/* Returns the mapping with the given HANDLE, after removing it
+   from the current process's list of mappings.  Terminates the
+   process if HANDLE is not associated with a mapping. */
+static struct mapping* remove_mapping(int handle) {
+  struct process* pcb = thread_current()->pcb;
+  struct list_elem* e;
+
+  lock_acquire(&pcb->fds_lock);
+  for (e = list_begin(&pcb->mappings); e != list_end(&pcb->mappings); e = list_next(e)) {
+    struct mapping* m = list_entry(e, struct mapping, elem);
+    if (m->handle == handle) {
+      list_remove(e);
+      lock_release(&pcb->fds_lock);
+      return m;
+    }
+  }
+  lock_release(&pcb->fds_lock);
+
+  pthread_exit_main();
+  NOT_REACHED();
+}
+
+/* Munmap system call.  Pages that the process changed are
+   written back to the file. */
+int sys_munmap(int handle) {
+  struct mapping* m = remove_mapping(handle);
+  size_t i;
+
+  for (i = 0; i < m->page_cnt; i++)
+    page_deallocate(m->base + i * PGSIZE);
+  file_close(m->file);
+  free(m);
+  return 0;
+}
+
+/* Fork system call. */
+int sys_fork(void) { return process_fork(thread_current()->syscall_if); }
+
+/* Returns true if any of the current process's mappings overlaps
+   the user virtual addresses [START, END).  The caller must hold
+   the process's descriptor lock. */
+static bool overlaps_mapping(uintptr_t start, uintptr_t end) {
+  struct process* pcb = thread_current()->pcb;
+  struct list_elem* e;
+
+  for (e = list_begin(&pcb->mappings); e != list_end(&pcb->mappings); e = list_next(e)) {
+    struct mapping* m = list_entry(e, struct mapping, elem);
+    uintptr_t base = (uintptr_t)m->base;
+    if (base < end && start < base + m->page_cnt * PGSIZE)
+      return true;
+  }
+  return false;
+}
+
+/* Sbrk system call.  Moves the end of the heap by INCREMENT bytes
+   and returns its old end, or (void*)-1 if the heap cannot be
+   moved that far.  New heap pages are zeroed when first touched,
+   and pages wholly above the new end are freed. */
+void* sys_sbrk(intptr_t increment) {
+  struct process* pcb = thread_current()->pcb;
+  size_t offset_cnt = sizeof pcb->offsets / sizeof *pcb->offsets;
+  uintptr_t old_brk, new_brk, limit;
+
+  /* The heap may grow up to the lowest thread stack. */
+  limit = (uintptr_t)PHYS_BASE - (MAX_STACK_PAGES + offset_cnt) * PGSIZE;
+
+  lock_acquire(&pcb->fds_lock);
+  old_brk = (uintptr_t)pcb->brk;
+  new_brk = old_brk + increment;
+  if ((increment > 0 && (new_brk < old_brk || new_brk > limit)) ||
+      (increment < 0 && (new_brk > old_brk || new_brk < (uintptr_t)pcb->heap_start))) {
+    lock_release(&pcb->fds_lock);
+    return (void*)-1;
+  }
+
+  /* Fails if the heap would run into a mapping. */
+  if (increment > 0 && overlaps_mapping(ROUND_UP(old_brk, PGSIZE), ROUND_UP(new_brk, PGSIZE))) {
+    lock_release(&pcb->fds_lock);
+    return (void*)-1;
+  }
+  page_set_brk((void*)new_brk);
+  lock_release(&pcb->fds_lock);
+  return (void*)old_brk;
+}
+#endif
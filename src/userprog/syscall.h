@@ -36,7 +36,17 @@ bool sys_sema_down(sema_t* sema);
 bool sys_sema_up(sema_t* sema);
 tid_t sys_get_tid(void);
 
+/* Diagnostics */
+int sys_iostat(void);
+
+#ifdef VM
+/* Virtual memory */
+int sys_mmap(int handle, void* addr);
+int sys_munmap(int handle);
+int sys_fork(void);
+void* sys_sbrk(intptr_t increment);
+#endif
+
 void syscall_init(void);
-void safe_file_close(struct file* file);
 
 #endif /* userprog/syscall.h */
@@ -0,0 +1,136 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include "devices/timer.h"
+#include "threads/loader.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "vm/page.h"
+
+/* Every frame of the user pool. */
+static struct frame* frames;
+static size_t frame_cnt;
+
+/* Serializes searches for a frame, and protects HAND. */
+static struct lock scan_lock;
+
+/* Next frame for the clock algorithm to consider. */
+static size_t hand;
+
+/* Takes every page of the user pool and makes it a frame. */
+void frame_init(void) {
+  void* base;
+
+  lock_init(&scan_lock);
+
+  frames = malloc(sizeof *frames * init_ram_pages);
+  if (frames == NULL)
+    PANIC("out of memory allocating page frames");
+
+  while ((base = palloc_get_page(PAL_USER)) != NULL) {
+    struct frame* f = &frames[frame_cnt++];
+    lock_init(&f->lock);
+    f->base = base;
+    list_init(&f->pages);
+  }
+}
+
+/* Tries to find a free frame, evicting the pages of a frame that
+   has not been used recently if there is none.  Returns the
+   frame, locked, with no pages, or a null pointer if every frame
+   is in use and none could be evicted.  Unlike
+   frame_alloc_and_lock(), never waits for a frame to come free. */
+struct frame* frame_try_alloc_and_lock(void) {
+  size_t i;
+
+  lock_acquire(&scan_lock);
+
+  /* Find a free frame. */
+  for (i = 0; i < frame_cnt; i++) {
+    struct frame* f = &frames[i];
+    if (lock_held_by_current_thread(&f->lock) || !lock_try_acquire(&f->lock))
+      continue;
+    if (list_empty(&f->pages)) {
+      lock_release(&scan_lock);
+      return f;
+    }
+    lock_release(&f->lock);
+  }
+
+  /* No free frame.  Sweep the clock hand around the frames,
+     giving each frame that has been used since the last sweep a
+     second chance, and evict the first one that hasn't.  Two
+     sweeps are enough to clear every accessed bit. */
+  for (i = 0; i < frame_cnt * 2; i++) {
+    struct frame* f = &frames[hand];
+    if (++hand >= frame_cnt)
+      hand = 0;
+
+    if (lock_held_by_current_thread(&f->lock) || !lock_try_acquire(&f->lock))
+      continue;
+
+    if (list_empty(&f->pages)) {
+      lock_release(&scan_lock);
+      return f;
+    }
+
+    if (page_pinned(f) || page_accessed_recently(f)) {
+      lock_release(&f->lock);
+      continue;
+    }
+
+    lock_release(&scan_lock);
+
+    /* Evict this frame. */
+    if (!page_out(f)) {
+      lock_release(&f->lock);
+      return NULL;
+    }
+    return f;
+  }
+
+  lock_release(&scan_lock);
+  return NULL;
+}
+
+/* Returns a free frame, locked, evicting pages to make room if
+   necessary.  Returns a null pointer if no frame can be freed,
+   because every frame is pinned or swap is full. */
+struct frame* frame_alloc_and_lock(void) {
+  size_t try;
+
+  for (try = 0; try < 3; try++) {
+    struct frame* f = frame_try_alloc_and_lock();
+    if (f != NULL) {
+      ASSERT(lock_held_by_current_thread(&f->lock));
+      return f;
+    }
+    timer_msleep(1000);
+  }
+
+  return NULL;
+}
+
+/* Locks P's frame, if it has one, so that it cannot be evicted.
+   The frame may be evicted while we wait for the lock, in which
+   case P no longer has a frame afterward and nothing is locked.
+   The caller must hold the lock of P's process's page table,
+   which keeps P from gaining a frame meanwhile. */
+void frame_lock(struct page* p) {
+  struct frame* f = p->frame;
+
+  if (f != NULL) {
+    lock_acquire(&f->lock);
+    if (f != p->frame) {
+      lock_release(&f->lock);
+      ASSERT(p->frame == NULL);
+    }
+  }
+}
+
+/* Unlocks frame F, allowing it to be evicted.  F must be locked
+   for use by the current thread.  If F has no pages, it becomes
+   free. */
+void frame_unlock(struct frame* f) {
+  ASSERT(lock_held_by_current_thread(&f->lock));
+  lock_release(&f->lock);
+}
@@ -0,0 +1,31 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <list.h>
+#include <stdbool.h>
+#include "threads/synch.h"
+
+struct page;
+
+/* A physical frame of the user pool.
+
+   A frame holds the contents of the pages in PAGES, each of
+   which is mapped to it in its own process's page directory.
+   Most frames hold a single page, but a read-only page of an
+   executable is shared among all the processes that run it, and
+   a forked process shares its parent's frames until one of them
+   writes.  A frame with no pages is free. */
+struct frame {
+  struct lock lock;  /* Prevents simultaneous access. */
+  void* base;        /* Kernel virtual base address. */
+  struct list pages; /* Mapped pages, as struct page's `frame_elem'. */
+};
+
+void frame_init(void);
+
+struct frame* frame_alloc_and_lock(void);
+struct frame* frame_try_alloc_and_lock(void);
+void frame_lock(struct page*);
+void frame_unlock(struct frame*);
+
+#endif /* vm/frame.h */
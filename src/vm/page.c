@@ -0,0 +1,743 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "vm/frame.h"
+#include "vm/share.h"
+#include "vm/swap.h"
+
+/* Largest number of pages read with a single request when a
+   page faults: the page itself and those that follow it in its
+   file or in swap. */
+#define CLUSTER_PAGES 8
+
+/* Size of the aligned block of pages around a faulting page in
+   which pages already in memory are mapped along with it. */
+#define FAULT_AROUND_PAGES 16
+
+/* Clustered reads go through this buffer, since the frames they
+   fill are not contiguous.  Its lock serializes them. */
+static void* cluster_buffer;
+static struct lock cluster_lock;
+
+/* Paging statistics. */
+static long long cluster_cnt;  /* Number of clustered reads. */
+static long long prefetch_cnt; /* Pages read ahead by clustered reads. */
+static long long around_cnt;   /* Pages mapped around faults. */
+
+/* Sets up clustered reads. */
+void page_init(void) {
+  cluster_buffer = palloc_get_multiple(0, CLUSTER_PAGES);
+  if (cluster_buffer == NULL)
+    PANIC("out of memory allocating cluster buffer");
+  lock_init(&cluster_lock);
+}
+
+/* Prints paging statistics. */
+void page_print_stats(void) {
+  printf("Paging: %lld clustered reads, %lld pages read ahead, %lld pages mapped around faults\n",
+         cluster_cnt, prefetch_cnt, around_cnt);
+}
+
+/* Returns a hash value for the page that E refers to. */
+static unsigned page_hash(const struct hash_elem* e, void* aux UNUSED) {
+  const struct page* p = hash_entry(e, struct page, hash_elem);
+  return hash_bytes(&p->addr, sizeof p->addr);
+}
+
+/* Returns true if page A precedes page B. */
+static bool page_less(const struct hash_elem* a_, const struct hash_elem* b_, void* aux UNUSED) {
+  const struct page* a = hash_entry(a_, struct page, hash_elem);
+  const struct page* b = hash_entry(b_, struct page, hash_elem);
+  return a->addr < b->addr;
+}
+
+/* Initializes PCB's supplemental page table.  Returns true if
+   successful, false if memory allocation fails. */
+bool page_table_init(struct process* pcb) {
+  lock_init(&pcb->pages_lock);
+  return hash_init(&pcb->pages, page_hash, page_less, NULL);
+}
+
+/* Returns true if P is a read-only page of an executable, which
+   is shared with other processes running the same executable. */
+static bool is_shared(const struct page* p) {
+  return p->file != NULL && p->private && !p->writable;
+}
+
+/* Takes P out of memory or swap, wherever it is, and drops its
+   reference to the shared copy, if any.  If it is in memory and
+   the process changed it, writes it back to its file first.  The
+   caller must hold the lock on P's page table. */
+static void release_page(struct page* p) {
+  uint32_t* pd = p->pcb->pagedir;
+
+  frame_lock(p);
+  if (p->frame != NULL) {
+    struct frame* f = p->frame;
+    if (p->file != NULL && !p->private && pagedir_is_dirty(pd, p->addr))
+      file_write_at(p->file, f->base, p->file_bytes, p->file_offset);
+    pagedir_clear_page(pd, p->addr);
+    list_remove(&p->frame_elem);
+    if (p->shared != NULL && list_empty(&f->pages))
+      p->shared->frame = NULL;
+    p->frame = NULL;
+    frame_unlock(f);
+  } else if (p->sector != SWAP_NONE)
+    swap_free(p->sector);
+
+  if (p->shared != NULL)
+    share_release(p->shared);
+}
+
+/* Frees the page that E refers to. */
+static void destroy_page(struct hash_elem* e, void* aux UNUSED) {
+  struct page* p = hash_entry(e, struct page, hash_elem);
+
+  release_page(p);
+  free(p);
+}
+
+/* Destroys the current process's supplemental page table,
+   freeing the frames and swap slots that its pages occupy.  This
+   must happen before the page directory is destroyed.
+   Memory-mapped files must already have been unmapped. */
+void page_table_destroy(void) {
+  struct process* pcb = thread_current()->pcb;
+
+  lock_acquire(&pcb->pages_lock);
+  hash_destroy(&pcb->pages, destroy_page);
+  lock_release(&pcb->pages_lock);
+}
+
+/* Returns the page containing user virtual address ADDR in the
+   current process's supplemental page table, or a null pointer
+   if there is none.  The caller must hold the table's lock. */
+static struct page* lookup_page(const void* addr) {
+  struct process* pcb = thread_current()->pcb;
+  struct hash_elem* e;
+  struct page p;
+
+  p.addr = pg_round_down(addr);
+  e = hash_find(&pcb->pages, &p.hash_elem);
+  return e != NULL ? hash_entry(e, struct page, hash_elem) : NULL;
+}
+
+/* Returns a new page for user virtual address ADDR in the current
+   process, which is not yet in its supplemental page table, or a
+   null pointer if memory allocation fails.  See page_allocate()
+   for the meaning of the other arguments. */
+static struct page* new_page(void* addr, bool writable, struct file* file, off_t offset,
+                             size_t bytes) {
+  struct page* p;
+
+  ASSERT(pg_ofs(addr) == 0);
+  ASSERT(bytes <= PGSIZE);
+
+  p = malloc(sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->addr = addr;
+  p->writable = writable;
+  p->pcb = thread_current()->pcb;
+  p->frame = NULL;
+  p->sector = SWAP_NONE;
+  p->pin_cnt = 0;
+  p->file = file;
+  p->file_offset = offset;
+  p->file_bytes = bytes;
+  p->private = false;
+  p->shared = NULL;
+  return p;
+}
+
+/* Returns true if user virtual address ADDR is in the current
+   process's heap, which runs from its heap_start up to the end
+   of the page that contains its last byte.  The caller must hold
+   the process's page table lock. */
+static bool is_heap_access(const void* addr) {
+  struct process* pcb = thread_current()->pcb;
+
+  return (const uint8_t*)addr >= pcb->heap_start &&
+         (const uint8_t*)addr < (const uint8_t*)pg_round_up(pcb->brk);
+}
+
+/* Adds the page at user virtual address ADDR to the current
+   process's supplemental page table, to be brought in on first
+   access.  It will hold BYTES bytes read from FILE at OFFSET,
+   followed by zeros, or all zeros if FILE is null.  The process
+   may write to it if WRITABLE is true.  Changes are written back
+   to FILE unless the caller sets the page's PRIVATE flag.
+   Returns the new page, or a null pointer if ADDR is already in
+   use, including by the heap, or memory allocation fails. */
+struct page* page_allocate(void* addr, bool writable, struct file* file, off_t offset,
+                           size_t bytes) {
+  struct process* pcb = thread_current()->pcb;
+  struct page* p;
+
+  p = new_page(addr, writable, file, offset, bytes);
+  if (p == NULL)
+    return NULL;
+
+  lock_acquire(&pcb->pages_lock);
+  if (is_heap_access(addr) || pagedir_get_page(pcb->pagedir, addr) != NULL ||
+      hash_insert(&pcb->pages, &p->hash_elem) != NULL) {
+    free(p);
+    p = NULL;
+  }
+  lock_release(&pcb->pages_lock);
+  return p;
+}
+
+/* Returns true if an access to user virtual address ADDR, which
+   is not part of the current process's address space, should
+   grow its stack.  That takes an address within MAX_STACK_PAGES
+   of the top of user memory, no more than 32 bytes below the
+   stack pointer, as PUSHA touches, while the stack pointer is
+   itself on the stack. */
+static bool is_stack_access(const void* addr) {
+  const uint8_t* bottom = (const uint8_t*)PHYS_BASE - MAX_STACK_PAGES * PGSIZE;
+  const uint8_t* esp = thread_current()->user_esp;
+
+  return (const uint8_t*)addr >= bottom && esp >= bottom && esp <= (const uint8_t*)PHYS_BASE &&
+         (const uint8_t*)addr + 32 >= esp;
+}
+
+/* Returns the current process's page containing user virtual
+   address ADDR, adding a zeroed page there if ADDR is in the heap
+   or the access grows the stack.  Returns a null pointer if ADDR
+   is not part of the process's address space.  The caller must
+   hold the process's page table lock. */
+static struct page* lookup_or_grow(const void* addr) {
+  struct process* pcb = thread_current()->pcb;
+  struct page* p = lookup_page(addr);
+
+  if (p == NULL && is_user_vaddr(addr) && (is_heap_access(addr) || is_stack_access(addr))) {
+    p = new_page(pg_round_down(addr), true, NULL, 0, 0);
+    if (p != NULL)
+      hash_insert(&pcb->pages, &p->hash_elem);
+  }
+  return p;
+}
+
+/* Moves the end of the current process's heap to BRK.  Heap
+   pages are added to the process's supplemental page table when
+   first touched, so moving the end up only records it.  Moving
+   it down frees the pages wholly above it, along with their
+   frames or swap slots. */
+void page_set_brk(void* brk) {
+  struct process* pcb = thread_current()->pcb;
+  uint8_t* old_end;
+  uint8_t* addr;
+
+  lock_acquire(&pcb->pages_lock);
+  old_end = pg_round_up(pcb->brk);
+  pcb->brk = brk;
+  for (addr = pg_round_up(brk); addr < old_end; addr += PGSIZE) {
+    struct page* p = lookup_page(addr);
+    if (p != NULL) {
+      hash_delete(&pcb->pages, &p->hash_elem);
+      release_page(p);
+      free(p);
+    }
+  }
+  lock_release(&pcb->pages_lock);
+}
+
+/* Removes the page at user virtual address ADDR from the current
+   process's supplemental page table and frees it, along with its
+   frame or swap slot.  If it is in memory and the process changed
+   it, writes it back to its file first. */
+void page_deallocate(void* addr) {
+  struct process* pcb = thread_current()->pcb;
+  struct page* p;
+
+  lock_acquire(&pcb->pages_lock);
+  p = lookup_page(addr);
+  ASSERT(p != NULL);
+  hash_delete(&pcb->pages, &p->hash_elem);
+  release_page(p);
+  lock_release(&pcb->pages_lock);
+  free(p);
+}
+
+/* Reads P's contents into a newly allocated frame, from swap,
+   its file, or the shared copy, or fills the frame with zeros.
+   Returns true if successful, with P's frame locked, false if no
+   frame can be freed or the file cannot be read.  The caller
+   must hold the lock on P's page table. */
+static bool load_page(struct page* p) {
+  struct frame* f;
+
+  if (is_shared(p))
+    return share_page_in(p, true);
+
+  f = frame_alloc_and_lock();
+  if (f == NULL)
+    return false;
+  if (p->sector != SWAP_NONE) {
+    swap_in(p->sector, f->base);
+    p->sector = SWAP_NONE;
+  } else if (p->file != NULL) {
+    if (file_read_at(p->file, f->base, p->file_bytes, p->file_offset) != (off_t)p->file_bytes) {
+      frame_unlock(f);
+      return false;
+    }
+    memset((uint8_t*)f->base + p->file_bytes, 0, PGSIZE - p->file_bytes);
+  } else
+    memset(f->base, 0, PGSIZE);
+
+  list_push_back(&f->pages, &p->frame_elem);
+  p->frame = f;
+  return true;
+}
+
+/* Maps P, which is in memory with its frame locked, into its
+   process's page directory, if it is not mapped.  P is mapped
+   read-only if it shares its frame, even if it is writable.
+   Returns true if successful, false otherwise, in which case P's
+   frame is unlocked. */
+static bool map_page(struct page* p) {
+  uint32_t* pd = p->pcb->pagedir;
+  bool writable = p->writable && list_size(&p->frame->pages) == 1;
+
+  if (pagedir_get_page(pd, p->addr) == NULL &&
+      !pagedir_set_page(pd, p->addr, p->frame->base, writable)) {
+    frame_unlock(p->frame);
+    return false;
+  }
+  return true;
+}
+
+/* Returns true if Q, a page of the current process, can be read
+   from disk together with PREV, the page just before it: neither
+   is in memory or shared, and Q's contents directly follow all
+   of PREV's in PREV's swap slot or file. */
+static bool follows(const struct page* q, const struct page* prev) {
+  if (q == NULL || q->frame != NULL || is_shared(q))
+    return false;
+  if (prev->sector != SWAP_NONE)
+    return q->sector == prev->sector + PAGE_SECTORS;
+  return q->sector == SWAP_NONE && q->file != NULL && q->file == prev->file &&
+         prev->file_bytes == PGSIZE && q->file_offset == prev->file_offset + PGSIZE;
+}
+
+/* Like load_page(), but reads P along with the pages that follow
+   it in swap or in its file, up to CLUSTER_PAGES in all, with a
+   single request, and maps the pages after P into the process's
+   page directory, so that a sequential scan does not fault on
+   each of them.  Returns false, having loaded nothing, if no
+   page follows P or the read fails, leaving it to load_page().
+   The caller must hold the lock on P's page table. */
+static bool load_cluster(struct page* p) {
+  struct page* pages[CLUSTER_PAGES];
+  struct frame* frames[CLUSTER_PAGES];
+  size_t cnt, i;
+  bool success;
+
+  if (is_shared(p) || (p->sector == SWAP_NONE && p->file == NULL))
+    return false;
+
+  /* Find the pages to read.  If another clustered read has the
+     buffer, read just P rather than wait for it. */
+  pages[0] = p;
+  for (cnt = 1; cnt < CLUSTER_PAGES; cnt++) {
+    pages[cnt] = lookup_page((uint8_t*)p->addr + cnt * PGSIZE);
+    if (!follows(pages[cnt], pages[cnt - 1]))
+      break;
+  }
+  if (cnt == 1 || !lock_try_acquire(&cluster_lock))
+    return false;
+
+  /* Get a frame for each page, reading fewer pages rather than
+     waiting for frames after the first. */
+  frames[0] = frame_alloc_and_lock();
+  if (frames[0] == NULL) {
+    lock_release(&cluster_lock);
+    return false;
+  }
+  for (i = 1; i < cnt; i++)
+    if ((frames[i] = frame_try_alloc_and_lock()) == NULL)
+      break;
+  cnt = i;
+
+  /* Read the pages and move each into its frame. */
+  if (p->sector != SWAP_NONE) {
+    swap_in_multiple(p->sector, cnt, cluster_buffer);
+    success = true;
+  } else {
+    off_t size = (cnt - 1) * PGSIZE + pages[cnt - 1]->file_bytes;
+    success = file_read_at(p->file, cluster_buffer, size, p->file_offset) == size;
+    memset((uint8_t*)cluster_buffer + size, 0, cnt * PGSIZE - size);
+  }
+  if (success)
+    for (i = 0; i < cnt; i++) {
+      memcpy(frames[i]->base, (uint8_t*)cluster_buffer + i * PGSIZE, PGSIZE);
+      pages[i]->sector = SWAP_NONE;
+      list_push_back(&frames[i]->pages, &pages[i]->frame_elem);
+      pages[i]->frame = frames[i];
+    }
+  lock_release(&cluster_lock);
+
+  if (!success) {
+    for (i = 0; i < cnt; i++)
+      frame_unlock(frames[i]);
+    return false;
+  }
+
+  /* Map the pages after P, leaving P's frame locked. */
+  for (i = 1; i < cnt; i++)
+    if (map_page(pages[i]))
+      frame_unlock(frames[i]);
+  cluster_cnt++;
+  prefetch_cnt += cnt - 1;
+  return true;
+}
+
+/* Brings P into memory, if it is not there, and maps it into its
+   process's page directory, if it is not mapped.  Pages that
+   follow P on disk may be read and mapped along with it.
+   Returns true if successful, with P's frame locked, false
+   otherwise.  The caller must hold the lock on P's page table. */
+static bool lock_page(struct page* p) {
+  frame_lock(p);
+  if (p->frame == NULL && !load_cluster(p) && !load_page(p))
+    return false;
+  return map_page(p);
+}
+
+/* Maps the pages in the aligned block of FAULT_AROUND_PAGES
+   pages around P, which just faulted, that are in memory but not
+   mapped, such as a forked process's pages that still share its
+   parent's frames or executable pages that another process has
+   read in.  That saves the faults that touching them would take.
+   Never reads from disk.  The caller must hold the lock on P's
+   page table. */
+static void fault_around(struct page* p) {
+  uint32_t* pd = p->pcb->pagedir;
+  uintptr_t block_size = FAULT_AROUND_PAGES * PGSIZE;
+  uint8_t* start = (uint8_t*)((uintptr_t)p->addr & ~(block_size - 1));
+  size_t i;
+
+  for (i = 0; i < FAULT_AROUND_PAGES; i++) {
+    struct page* q = lookup_page(start + i * PGSIZE);
+    if (q == NULL || q == p || pagedir_get_page(pd, q->addr) != NULL)
+      continue;
+    frame_lock(q);
+    if (q->frame == NULL && !(is_shared(q) && share_page_in(q, false)))
+      continue;
+    if (map_page(q)) {
+      frame_unlock(q->frame);
+      around_cnt++;
+    }
+  }
+}
+
+/* Makes P, which must be writable, in memory, and mapped, with
+   its frame locked, writable in its process's page directory.
+   If P shares its frame with other pages, they move to a copy of
+   the frame, so that P keeps any pins that the kernel holds on
+   it.  Returns true if successful, false if no frame can be
+   freed for the copy. */
+static bool unshare_page(struct page* p) {
+  struct frame* f = p->frame;
+
+  ASSERT(p->writable);
+
+  if (list_size(&f->pages) > 1) {
+    struct frame* copy = frame_alloc_and_lock();
+    struct list_elem* e;
+
+    if (copy == NULL)
+      return false;
+    memcpy(copy->base, f->base, PGSIZE);
+
+    for (e = list_begin(&f->pages); e != list_end(&f->pages);) {
+      struct page* q = list_entry(e, struct page, frame_elem);
+      uint32_t* pd = q->pcb->pagedir;
+
+      e = list_next(e);
+      if (q == p)
+        continue;
+      list_remove(&q->frame_elem);
+      list_push_back(&copy->pages, &q->frame_elem);
+      q->frame = copy;
+
+      /* Remap Q in place, so that a pinned page never faults. */
+      if (pagedir_get_page(pd, q->addr) != NULL) {
+        pagedir_clear_page(pd, q->addr);
+        pagedir_set_page(pd, q->addr, copy->base, false);
+      }
+    }
+    frame_unlock(copy);
+  }
+
+  pagedir_set_writable(p->pcb->pagedir, p->addr, true);
+  return true;
+}
+
+/* Makes a copy of Q, a page of PARENT, for the current process,
+   which is being forked from PARENT.  Returns true if successful,
+   false if memory runs out.  The caller must hold PARENT's page
+   table lock. */
+static bool copy_page(struct page* q, struct process* parent) {
+  struct process* pcb = thread_current()->pcb;
+  struct page* c;
+  struct frame* f;
+
+  /* Memory-mapped files are not inherited. */
+  if (q->file != NULL && !q->private)
+    return true;
+
+  /* The child's executable pages refer to its own copy of the
+     executable.  Read-only ones are found in the shared page
+     table on their first access, as usual. */
+  c = new_page(q->addr, q->writable, q->file != NULL ? pcb->bin_file : NULL, q->file_offset,
+               q->file_bytes);
+  if (c == NULL)
+    return false;
+  c->private = q->private;
+  hash_insert(&pcb->pages, &c->hash_elem);
+  if (is_shared(q))
+    return true;
+
+  frame_lock(q);
+  f = q->frame;
+  if (f == NULL) {
+    /* Share Q's swap slot, if it has one. */
+    if (q->sector != SWAP_NONE) {
+      swap_dup(q->sector);
+      c->sector = q->sector;
+    }
+    return true;
+  }
+
+  if (q->pin_cnt > 0) {
+    /* A system call may be writing to Q, so give the child its
+       own copy now. */
+    struct frame* copy = frame_alloc_and_lock();
+    if (copy == NULL) {
+      frame_unlock(f);
+      return false;
+    }
+    memcpy(copy->base, f->base, PGSIZE);
+    c->file = NULL;
+    list_push_back(&copy->pages, &c->frame_elem);
+    c->frame = copy;
+    frame_unlock(copy);
+  } else {
+    /* Share Q's frame, read-only.  If the parent already changed
+       an executable page, neither copy can be read back from the
+       file any more. */
+    if (q->file != NULL && pagedir_is_dirty(parent->pagedir, q->addr)) {
+      struct list_elem* e;
+      for (e = list_begin(&f->pages); e != list_end(&f->pages); e = list_next(e))
+        list_entry(e, struct page, frame_elem)->file = NULL;
+      c->file = NULL;
+    }
+    pagedir_set_writable(parent->pagedir, q->addr, false);
+    list_push_back(&f->pages, &c->frame_elem);
+    c->frame = f;
+  }
+  frame_unlock(f);
+  return true;
+}
+
+/* Fills the current process's supplemental page table, which must
+   be empty, with copies of PARENT's pages, for fork.  Pages in
+   memory or swap are shared with PARENT until one of the two
+   processes writes to them.  The current process's page
+   directory and executable must already be set up.  Returns true
+   if successful, false if memory runs out, in which case the
+   pages copied so far are left for page_table_destroy(). */
+bool page_table_copy(struct process* parent) {
+  struct hash_iterator i;
+  bool success = true;
+
+  lock_acquire(&parent->pages_lock);
+  hash_first(&i, &parent->pages);
+  while (success && hash_next(&i))
+    success = copy_page(hash_entry(hash_cur(&i), struct page, hash_elem), parent);
+  lock_release(&parent->pages_lock);
+  return success;
+}
+
+/* Brings the page containing FAULT_ADDR into memory, if the
+   current process has one there that is not in memory yet, or
+   if the access grows the process's stack.  Also maps nearby
+   pages that are already in memory.  Returns true if the
+   access that faulted can be retried, false if FAULT_ADDR is not
+   part of the process's address space or the page cannot be
+   brought in. */
+bool page_in(void* fault_addr) {
+  struct process* pcb = thread_current()->pcb;
+  struct page* p;
+  bool success = false;
+
+  if (pcb == NULL || pcb->pagedir == NULL || !is_user_vaddr(fault_addr))
+    return false;
+
+  lock_acquire(&pcb->pages_lock);
+  p = lookup_or_grow(fault_addr);
+  if (p != NULL && lock_page(p)) {
+    frame_unlock(p->frame);
+    fault_around(p);
+    success = true;
+  }
+  lock_release(&pcb->pages_lock);
+  return success;
+}
+
+/* Handles a write to FAULT_ADDR that faulted because its page is
+   mapped read-only, by giving the page a frame of its own if it
+   is writable but shared after a fork.  Returns true if the
+   write can be retried, false if the page is read-only or no
+   frame can be freed for the copy. */
+bool page_unshare(void* fault_addr) {
+  struct process* pcb = thread_current()->pcb;
+  struct page* p;
+  bool success = false;
+
+  if (pcb == NULL || pcb->pagedir == NULL || !is_user_vaddr(fault_addr))
+    return false;
+
+  lock_acquire(&pcb->pages_lock);
+  p = lookup_page(fault_addr);
+  if (p != NULL && p->writable && lock_page(p)) {
+    success = unshare_page(p);
+    frame_unlock(p->frame);
+  }
+  lock_release(&pcb->pages_lock);
+  return success;
+}
+
+/* Brings the current process's page that contains user address
+   UADDR into memory, growing the stack if the access calls for
+   it, and pins it there, so that the kernel can access it
+   without faulting until page_unpin() is called.  If WRITE is
+   true, the page must be writable, and it is given a frame of
+   its own if it shares one.  Returns the page's kernel virtual
+   address, or a null pointer if there is no such page or it
+   cannot be brought in. */
+void* page_pin(const void* uaddr, bool write) {
+  struct process* pcb = thread_current()->pcb;
+  struct page* p;
+  void* kpage = NULL;
+
+  lock_acquire(&pcb->pages_lock);
+  p = lookup_or_grow(uaddr);
+  if (p != NULL && (p->writable || !write) && lock_page(p)) {
+    if (!write || unshare_page(p)) {
+      p->pin_cnt++;
+      kpage = p->frame->base;
+    }
+    frame_unlock(p->frame);
+  }
+  lock_release(&pcb->pages_lock);
+  return kpage;
+}
+
+/* Unpins the page containing user address UADDR, which
+   page_pin() pinned, so that it may be evicted again. */
+void page_unpin(const void* uaddr) {
+  struct process* pcb = thread_current()->pcb;
+  struct page* p;
+
+  lock_acquire(&pcb->pages_lock);
+  p = lookup_page(uaddr);
+  if (p != NULL) {
+    frame_lock(p);
+    ASSERT(p->pin_cnt > 0);
+    p->pin_cnt--;
+    if (p->frame != NULL)
+      frame_unlock(p->frame);
+  }
+  lock_release(&pcb->pages_lock);
+}
+
+/* Returns true if any page in frame F is pinned.  F must be
+   locked. */
+bool page_pinned(struct frame* f) {
+  struct list_elem* e;
+
+  for (e = list_begin(&f->pages); e != list_end(&f->pages); e = list_next(e))
+    if (list_entry(e, struct page, frame_elem)->pin_cnt > 0)
+      return true;
+  return false;
+}
+
+/* Returns true if any page in frame F has been accessed since the
+   last call, and clears their accessed bits.  F must be locked. */
+bool page_accessed_recently(struct frame* f) {
+  bool accessed = false;
+  struct list_elem* e;
+
+  for (e = list_begin(&f->pages); e != list_end(&f->pages); e = list_next(e)) {
+    struct page* p = list_entry(e, struct page, frame_elem);
+    if (pagedir_is_accessed(p->pcb->pagedir, p->addr)) {
+      pagedir_set_accessed(p->pcb->pagedir, p->addr, false);
+      accessed = true;
+    }
+  }
+  return accessed;
+}
+
+/* Evicts the pages in frame F, which must be locked, so that F can
+   be reused.  Each page is unmapped from its process's page
+   directory first, so that the process cannot change it while it
+   is written out.  A page of a memory-mapped file is written back
+   if it was changed.  A page whose contents exist nowhere else
+   goes to swap.  Other pages are dropped, to be read in again on
+   their next access.
+
+   Returns true if successful, leaving F free.  Returns false if
+   swap is full, leaving the pages in F, to be mapped again on
+   their next access. */
+bool page_out(struct frame* f) {
+  struct page* p = list_entry(list_front(&f->pages), struct page, frame_elem);
+  block_sector_t sector = SWAP_NONE;
+  bool dirty = false;
+  struct list_elem* e;
+
+  ASSERT(lock_held_by_current_thread(&f->lock));
+
+  for (e = list_begin(&f->pages); e != list_end(&f->pages); e = list_next(e)) {
+    struct page* q = list_entry(e, struct page, frame_elem);
+    if (pagedir_is_dirty(q->pcb->pagedir, q->addr))
+      dirty = true;
+    pagedir_clear_page(q->pcb->pagedir, q->addr);
+  }
+
+  if (p->shared != NULL)
+    p->shared->frame = NULL;
+  else if (p->file != NULL && !p->private) {
+    if (dirty)
+      file_write_at(p->file, f->base, p->file_bytes, p->file_offset);
+  } else if (p->file == NULL || dirty) {
+    /* A changed page of an executable no longer matches the
+       file, so from now on it lives in swap. */
+    for (e = list_begin(&f->pages); e != list_end(&f->pages); e = list_next(e))
+      list_entry(e, struct page, frame_elem)->file = NULL;
+    sector = swap_out(f->base);
+    if (sector == SWAP_NONE)
+      return false;
+  }
+
+  /* Every page in F shares the swap slot, if there is one. */
+  while (!list_empty(&f->pages)) {
+    struct page* q = list_entry(list_pop_front(&f->pages), struct page, frame_elem);
+    q->frame = NULL;
+    q->sector = sector;
+    if (sector != SWAP_NONE && !list_empty(&f->pages))
+      swap_dup(sector);
+  }
+  return true;
+}
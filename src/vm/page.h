@@ -0,0 +1,72 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+struct file;
+struct frame;
+struct process;
+struct shared_page;
+
+/* A page of a process's virtual memory that is brought in on
+   demand, as recorded in the process's supplemental page table.
+
+   A page with a FILE holds FILE_BYTES bytes read from FILE at
+   FILE_OFFSET, followed by zeros.  When it leaves memory, it is
+   written back to the file if the process changed it, unless it
+   is PRIVATE, as the pages of an executable's segments are.  A
+   private page that the process changed goes to swap instead,
+   and from then on has no FILE.  A page without a FILE starts
+   out as all zeros.
+
+   A forked process's pages start out sharing their parent's
+   frames and swap slots.  A page that shares its frame with
+   another writable page is mapped read-only until it is written,
+   which gives one of them a copy of the frame.
+
+   FRAME, FRAME_ELEM, SECTOR, and PIN_CNT are protected by the
+   lock of the page's frame while it has one.  A page gains a
+   frame only while its process's page table is locked. */
+struct page {
+  struct hash_elem hash_elem; /* Element in the process's `pages'. */
+  void* addr;                 /* User virtual address. */
+  bool writable;              /* May the process write to the page? */
+  struct process* pcb;        /* Owning process. */
+
+  struct frame* frame;         /* Frame holding the page, or null. */
+  struct list_elem frame_elem; /* Element in the frame's `pages'. */
+  block_sector_t sector;       /* First sector of swap slot, or SWAP_NONE. */
+  int pin_cnt;                 /* Number of times pinned in memory. */
+
+  struct file* file;          /* Backing file, or null. */
+  off_t file_offset;          /* Offset of the page's data in FILE. */
+  size_t file_bytes;          /* Number of bytes of data, 0...PGSIZE. */
+  bool private;               /* Keep changes out of FILE? */
+  struct shared_page* shared; /* Copy shared among processes, or null. */
+};
+
+void page_init(void);
+void page_print_stats(void);
+
+bool page_table_init(struct process*);
+void page_table_destroy(void);
+
+struct page* page_allocate(void* addr, bool writable, struct file*, off_t offset, size_t bytes);
+void page_deallocate(void* addr);
+void page_set_brk(void* brk);
+bool page_table_copy(struct process* parent);
+bool page_in(void* fault_addr);
+bool page_unshare(void* fault_addr);
+void* page_pin(const void* uaddr, bool write);
+void page_unpin(const void* uaddr);
+
+bool page_pinned(struct frame*);
+bool page_accessed_recently(struct frame*);
+bool page_out(struct frame*);
+
+#endif /* vm/page.h */
@@ -0,0 +1,172 @@
+#include "vm/share.h"
+#include <debug.h>
+#include <hash.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+
+/* Shared pages, hashed by inode, offset and length.  Two pages
+   at the same offset of the same executable that read different
+   numbers of bytes from it have different contents, so they are
+   not shared. */
+static struct hash shared_pages;
+
+/* Protects shared_pages, the reference counts and LOADING
+   members of its members, and their FRAME members, which may also
+   be set to null by a thread that holds the lock of the frame
+   they point to.  Not held while reading a page in. */
+static struct lock share_lock;
+
+/* Returns a hash value for the shared page containing E. */
+static unsigned shared_page_hash(const struct hash_elem* e, void* aux UNUSED) {
+  const struct shared_page* s = hash_entry(e, struct shared_page, elem);
+  return hash_bytes(&s->inode, sizeof s->inode) ^ hash_int(s->offset) ^ hash_int(s->file_bytes);
+}
+
+/* Returns true if shared page A precedes shared page B. */
+static bool shared_page_less(const struct hash_elem* a_, const struct hash_elem* b_,
+                             void* aux UNUSED) {
+  const struct shared_page* a = hash_entry(a_, struct shared_page, elem);
+  const struct shared_page* b = hash_entry(b_, struct shared_page, elem);
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->offset != b->offset)
+    return a->offset < b->offset;
+  return a->file_bytes < b->file_bytes;
+}
+
+/* Initializes the table of shared pages. */
+void share_init(void) {
+  if (!hash_init(&shared_pages, shared_page_hash, shared_page_less, NULL))
+    PANIC("can't create shared page table");
+  lock_init(&share_lock);
+}
+
+/* Returns the shared page that holds FILE_BYTES bytes of FILE
+   starting at OFFSET, creating it if there is none yet, and takes
+   a reference to it.  Returns a null pointer if memory runs out.
+   The caller must hold share_lock. */
+static struct shared_page* acquire(struct file* file, off_t offset, size_t file_bytes) {
+  struct shared_page key;
+  struct shared_page* s;
+  struct hash_elem* e;
+
+  key.inode = file_get_inode(file);
+  key.offset = offset;
+  key.file_bytes = file_bytes;
+  e = hash_find(&shared_pages, &key.elem);
+  if (e != NULL)
+    s = hash_entry(e, struct shared_page, elem);
+  else {
+    s = malloc(sizeof *s);
+    if (s == NULL)
+      return NULL;
+    s->inode = inode_reopen(key.inode);
+    s->offset = offset;
+    s->file_bytes = file_bytes;
+    s->frame = NULL;
+    s->loading = false;
+    cond_init(&s->loaded);
+    s->ref_cnt = 0;
+    hash_insert(&shared_pages, &s->elem);
+  }
+  s->ref_cnt++;
+  return s;
+}
+
+/* Brings P, a read-only page of an executable, into the frame
+   that holds it for every process running the executable,
+   reading it in first if no process has it in memory, unless
+   READ is false.  Returns true if successful, with P's frame
+   locked, or false if memory runs out, the file cannot be read,
+   or READ is false and the page would have to be read or is
+   being read by another thread.
+
+   share_lock is dropped while reading, so that other shared
+   pages can be brought in meanwhile.  Threads that want the same
+   page wait for the read to finish instead of reading it again.
+
+   P's file must be open with writes denied, as executables are,
+   so that the frame cannot go stale.  The caller must hold the
+   lock on P's page table, which keeps P's reference to its
+   shared page alive while share_lock is dropped. */
+bool share_page_in(struct page* p, bool read) {
+  struct shared_page* s;
+  struct frame* f;
+  bool success = false;
+
+  ASSERT(p->frame == NULL);
+
+  lock_acquire(&share_lock);
+  if (p->shared == NULL)
+    p->shared = acquire(p->file, p->file_offset, p->file_bytes);
+  s = p->shared;
+  if (s == NULL)
+    goto done;
+  while (s->loading) {
+    if (!read)
+      goto done;
+    cond_wait(&s->loaded, &share_lock);
+  }
+
+  /* Use the frame that already holds the page, unless it is
+     evicted while we wait for its lock. */
+  f = s->frame;
+  if (f != NULL) {
+    lock_acquire(&f->lock);
+    if (f != s->frame) {
+      lock_release(&f->lock);
+      f = NULL;
+    }
+  }
+
+  /* Otherwise, read the page into a new frame. */
+  if (f == NULL) {
+    if (!read)
+      goto done;
+    s->loading = true;
+    lock_release(&share_lock);
+    f = frame_alloc_and_lock();
+    if (f != NULL) {
+      if (file_read_at(p->file, f->base, p->file_bytes, p->file_offset) == (off_t)p->file_bytes)
+        memset((uint8_t*)f->base + p->file_bytes, 0, PGSIZE - p->file_bytes);
+      else {
+        frame_unlock(f);
+        f = NULL;
+      }
+    }
+    lock_acquire(&share_lock);
+    s->loading = false;
+    s->frame = f;
+    cond_broadcast(&s->loaded, &share_lock);
+    if (f == NULL)
+      goto done;
+  }
+
+  list_push_back(&f->pages, &p->frame_elem);
+  p->frame = f;
+  success = true;
+
+done:
+  lock_release(&share_lock);
+  return success;
+}
+
+/* Drops a reference to S, taken by share_page_in().  Frees S
+   once no page refers to it.  The caller must have removed its
+   page from S's frame, if it was there. */
+void share_release(struct shared_page* s) {
+  lock_acquire(&share_lock);
+  if (--s->ref_cnt == 0) {
+    ASSERT(s->frame == NULL);
+    hash_delete(&shared_pages, &s->elem);
+    inode_close(s->inode);
+    free(s);
+  }
+  lock_release(&share_lock);
+}
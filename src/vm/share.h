@@ -0,0 +1,30 @@
+#ifndef VM_SHARE_H
+#define VM_SHARE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct frame;
+struct inode;
+struct page;
+
+/* A read-only page of an executable, read in once and mapped
+   into every process that runs the executable. */
+struct shared_page {
+  struct hash_elem elem;   /* Element in shared_pages. */
+  struct inode* inode;     /* Executable, held open. */
+  off_t offset;            /* Offset of the page in INODE. */
+  size_t file_bytes;       /* Bytes read from INODE, the rest zeroed. */
+  struct frame* frame;     /* Frame holding the contents, or null. */
+  bool loading;            /* True while a thread reads it into a frame. */
+  struct condition loaded; /* Signaled when LOADING becomes false. */
+  int ref_cnt;             /* Number of pages that refer to this. */
+};
+
+void share_init(void);
+bool share_page_in(struct page*, bool read);
+void share_release(struct shared_page*);
+
+#endif /* vm/share.h */
@@ -0,0 +1,93 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The swap device. */
+static struct block* swap_device;
+
+/* Used swap slots, one bit per page. */
+static struct bitmap* swap_bitmap;
+
+/* Number of pages that refer to each used slot.  Pages of
+   processes that fork share their parent's slots. */
+static unsigned* swap_refs;
+
+/* Protects swap_bitmap and swap_refs. */
+static struct lock swap_lock;
+
+/* Sets up swap. */
+void swap_init(void) {
+  size_t slot_cnt = 0;
+
+  swap_device = block_get_role(BLOCK_SWAP);
+  if (swap_device == NULL)
+    printf("no swap device--swap disabled\n");
+  else
+    slot_cnt = block_size(swap_device) / PAGE_SECTORS;
+  swap_bitmap = bitmap_create(slot_cnt);
+  swap_refs = calloc(slot_cnt, sizeof *swap_refs);
+  if (swap_bitmap == NULL || (slot_cnt > 0 && swap_refs == NULL))
+    PANIC("couldn't create swap bitmap");
+  lock_init(&swap_lock);
+}
+
+/* Writes the page at KPAGE to a free swap slot and returns the
+   slot's first sector, or SWAP_NONE if swap is full.  The slot
+   starts out with one reference. */
+block_sector_t swap_out(const void* kpage) {
+  size_t slot;
+
+  lock_acquire(&swap_lock);
+  slot = bitmap_scan_and_flip(swap_bitmap, 0, 1, false);
+  if (slot != BITMAP_ERROR)
+    swap_refs[slot] = 1;
+  lock_release(&swap_lock);
+  if (slot == BITMAP_ERROR)
+    return SWAP_NONE;
+
+  block_write_multiple(swap_device, slot * PAGE_SECTORS, PAGE_SECTORS, kpage);
+  return slot * PAGE_SECTORS;
+}
+
+/* Reads the swap slot starting at SECTOR into the page at KPAGE
+   and drops a reference to the slot. */
+void swap_in(block_sector_t sector, void* kpage) { swap_in_multiple(sector, 1, kpage); }
+
+/* Reads the CNT consecutive swap slots starting at SECTOR into
+   BUFFER, which must have room for CNT pages, with a single
+   request, and drops a reference to each slot. */
+void swap_in_multiple(block_sector_t sector, size_t cnt, void* buffer) {
+  size_t i;
+
+  block_read_multiple(swap_device, sector, cnt * PAGE_SECTORS, buffer);
+  for (i = 0; i < cnt; i++)
+    swap_free(sector + i * PAGE_SECTORS);
+}
+
+/* Adds a reference to the swap slot starting at SECTOR. */
+void swap_dup(block_sector_t sector) {
+  ASSERT(sector % PAGE_SECTORS == 0);
+
+  lock_acquire(&swap_lock);
+  ASSERT(bitmap_test(swap_bitmap, sector / PAGE_SECTORS));
+  swap_refs[sector / PAGE_SECTORS]++;
+  lock_release(&swap_lock);
+}
+
+/* Drops a reference to the swap slot starting at SECTOR without
+   reading it, freeing the slot if that was the last one. */
+void swap_free(block_sector_t sector) {
+  size_t slot = sector / PAGE_SECTORS;
+
+  ASSERT(sector % PAGE_SECTORS == 0);
+
+  lock_acquire(&swap_lock);
+  ASSERT(bitmap_test(swap_bitmap, slot));
+  if (--swap_refs[slot] == 0)
+    bitmap_reset(swap_bitmap, slot);
+  lock_release(&swap_lock);
+}
@@ -0,0 +1,21 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stddef.h>
+#include "devices/block.h"
+#include "threads/vaddr.h"
+
+/* Number of sectors per page, and so per swap slot. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Not a swap slot.  Returned by swap_out() when swap is full. */
+#define SWAP_NONE ((block_sector_t)-1)
+
+void swap_init(void);
+block_sector_t swap_out(const void* kpage);
+void swap_in(block_sector_t, void* kpage);
+void swap_in_multiple(block_sector_t, size_t cnt, void* buffer);
+void swap_dup(block_sector_t);
+void swap_free(block_sector_t);
+
+#endif /* vm/swap.h */